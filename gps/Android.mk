@@ -2,9 +2,7 @@
 
   LOCAL_PATH := $(call my-dir)/nmea
 
-  include $(CLEAR_VARS)
-  
-  LOCAL_SRC_FILES := \
+  nmea_src_files := \
     generate.c 	\
     generator.c \
     parse.c	\
@@ -14,7 +12,12 @@
     time.c	\
     info.c	\
     gmath.c	\
-    sentence.c
+    sentence.c \
+    sattab.c
+
+  include $(CLEAR_VARS)
+  
+  LOCAL_SRC_FILES := $(nmea_src_files)
 
   LOCAL_MODULE := nmea
 
@@ -34,7 +37,10 @@
   include $(CLEAR_VARS)
   
   LOCAL_SRC_FILES := \
-	../gpslib.c
+	../gpslib.c \
+	../gpsfilter.c \
+	../gpsstats.c \
+	../gpsubx.c
 
   LOCAL_MODULE := gps.harmony
 
@@ -53,3 +59,76 @@
   
   LOCAL_PRELINK_MODULE := false
   include $(BUILD_SHARED_LIBRARY)
+
+  # Host tool comparing the nmea_scanf parsers with the field parsers
+  include $(CLEAR_VARS)
+
+  LOCAL_SRC_FILES := $(nmea_src_files)
+
+  LOCAL_MODULE := libnmea_host
+
+  LOCAL_MODULE_TAGS := optional
+
+  include $(BUILD_HOST_STATIC_LIBRARY)
+
+  include $(CLEAR_VARS)
+
+  LOCAL_SRC_FILES := \
+	../nmea_bench.c
+
+  LOCAL_MODULE := nmea_bench
+
+  LOCAL_MODULE_TAGS := optional
+
+  LOCAL_STATIC_LIBRARIES := \
+	libnmea_host
+
+  LOCAL_LDLIBS := -lm -lrt
+
+  include $(BUILD_HOST_EXECUTABLE)
+
+  include $(CLEAR_VARS)
+
+  LOCAL_SRC_FILES := \
+	../gmath_bench.c
+
+  LOCAL_MODULE := gmath_bench
+
+  LOCAL_MODULE_TAGS := optional
+
+  LOCAL_STATIC_LIBRARIES := \
+	libnmea_host
+
+  LOCAL_LDLIBS := -lm -lrt
+
+  include $(BUILD_HOST_EXECUTABLE)
+
+  # Host load benchmark of the HAL, gpslib.c reads a pty instead of the tty
+  include $(CLEAR_VARS)
+
+  LOCAL_SRC_FILES := \
+	../gps_bench.c \
+	../gpslib.c \
+	../gpsfilter.c \
+	../gpsstats.c \
+	../gpsubx.c
+
+  LOCAL_MODULE := gps_bench
+
+  LOCAL_MODULE_TAGS := optional
+
+  LOCAL_CFLAGS := -D_GNU_SOURCE \
+	-DGPS_TTYPORT=\"/tmp/gps_bench.tty\" \
+	-DGPS_CAPTURE_DIR=\"/tmp/gps_bench.data\"
+
+  LOCAL_C_INCLUDES := hardware/libhardware/include
+
+  LOCAL_STATIC_LIBRARIES := \
+	libnmea_host \
+	libcutils \
+	liblog
+
+  LOCAL_LDLIBS := -lm -lrt -lpthread
+  LOCAL_LDFLAGS := -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+
+  include $(BUILD_HOST_EXECUTABLE)
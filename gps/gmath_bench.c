@@ -0,0 +1,188 @@
+/*
+ * NMEA library geodesy benchmark (host tool)
+ *
+ * Times the scalar nmea_distance_ellipsoid and nmea_distance over a random
+ * walk track and over random pairs against nmea_distance_ellipsoid_batch,
+ * nmea_distance_batch and nmea_track_length. Prints points/sec for each,
+ * fails if the batch ellipsoid distances differ from the scalar ones by
+ * more than a millimetre, and prints the worst haversine error relative
+ * to the ellipsoid.
+ *
+ * Usage: gmath_bench [points]
+ */
+
+#include "nmea/nmea/nmea.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_POINTS    (1000000)
+#define BENCH_STEP_M    (30.0)      /* Largest step of the random walk */
+#define BENCH_MAX_DIFF  (1e-3)      /* Batch vs scalar ellipsoid, meters */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+/* A track around Munich, one fix every BENCH_STEP_M meters or less */
+static void walk(double *lat, double *lon, int count)
+{
+    double step = BENCH_STEP_M / NMEA_EARTH_MEANRADIUS_M;
+    int i;
+
+    lat[0] = nmea_degree2radian(48.117);
+    lon[0] = nmea_degree2radian(11.517);
+    for(i = 1; i < count; ++i)
+    {
+        lat[i] = lat[i - 1] + uniform(-step, step);
+        lon[i] = lon[i - 1] + uniform(-step, step) / cos(lat[i]);
+    }
+}
+
+/* Points whose pairs are less than 90 degrees of arc apart, as far as
+ * the scalar nmea_distance_ellipsoid goes */
+static void scatter(double *lat, double *lon, int count)
+{
+    int i;
+
+    for(i = 0; i < count; ++i)
+    {
+        lat[i] = uniform(-0.5, 0.5);
+        lon[i] = uniform(-0.5, 0.5);
+    }
+}
+
+static double scalar_ellipsoid(const double *from_lat, const double *from_lon,
+        const double *to_lat, const double *to_lon, int count, double *distance)
+{
+    nmeaPOS from, to;
+    double start = now();
+    int i;
+
+    for(i = 0; i < count; ++i)
+    {
+        from.lat = from_lat[i];
+        from.lon = from_lon[i];
+        to.lat = to_lat[i];
+        to.lon = to_lon[i];
+        distance[i] = nmea_distance_ellipsoid(&from, &to, 0, 0);
+    }
+
+    return count / (now() - start);
+}
+
+static double scalar_sphere(const double *from_lat, const double *from_lon,
+        const double *to_lat, const double *to_lon, int count, double *distance)
+{
+    nmeaPOS from, to;
+    double start = now();
+    int i;
+
+    for(i = 0; i < count; ++i)
+    {
+        from.lat = from_lat[i];
+        from.lon = from_lon[i];
+        to.lat = to_lat[i];
+        to.lon = to_lon[i];
+        distance[i] = nmea_distance(&from, &to);
+    }
+
+    return count / (now() - start);
+}
+
+/* Runs every path over the pairs, returns 0 if the ellipsoid paths disagree */
+static int bench(const char *name, const double *from_lat, const double *from_lon,
+        const double *to_lat, const double *to_lon, int count, double *ref, double *out)
+{
+    double rate_scalar, rate_batch, start, diff = 0, error = 0;
+    int i;
+
+    rate_scalar = scalar_ellipsoid(from_lat, from_lon, to_lat, to_lon, count, ref);
+    start = now();
+    nmea_distance_ellipsoid_batch(from_lat, from_lon, to_lat, to_lon, count, out, 0, 0);
+    rate_batch = count / (now() - start);
+
+    for(i = 0; i < count; ++i)
+    {
+        if(fabs(out[i] - ref[i]) > diff)
+            diff = fabs(out[i] - ref[i]);
+    }
+
+    printf("%s\n", name);
+    printf("  nmea_distance_ellipsoid:       %10.0f pairs/sec\n", rate_scalar);
+    printf("  nmea_distance_ellipsoid_batch: %10.0f pairs/sec (x%.2f)\n", rate_batch, rate_batch / rate_scalar);
+
+    rate_scalar = scalar_sphere(from_lat, from_lon, to_lat, to_lon, count, out);
+    start = now();
+    nmea_distance_batch(from_lat, from_lon, to_lat, to_lon, count, out, 0);
+    rate_batch = count / (now() - start);
+
+    for(i = 0; i < count; ++i)
+    {
+        if(ref[i] > 1 && fabs(out[i] - ref[i]) / ref[i] > error)
+            error = fabs(out[i] - ref[i]) / ref[i];
+    }
+
+    printf("  nmea_distance:                 %10.0f pairs/sec\n", rate_scalar);
+    printf("  nmea_distance_batch:           %10.0f pairs/sec (x%.2f)\n",
+        rate_batch, rate_batch / rate_scalar);
+    printf("  ellipsoid batch vs scalar: %.2e m, haversine vs ellipsoid: %.3f%%\n", diff, error * 100);
+
+    return diff <= BENCH_MAX_DIFF;
+}
+
+int main(int argc, char *argv[])
+{
+    int points = (argc > 1) ? atoi(argv[1]) : BENCH_POINTS;
+    double *lat, *lon, *to_lat, *to_lon, *ref, *out;
+    double start, rate, total, sum = 0;
+    int i, ok;
+
+    if(points < 2)
+        points = 2;
+
+    lat = malloc(points * sizeof(double));
+    lon = malloc(points * sizeof(double));
+    to_lat = malloc(points * sizeof(double));
+    to_lon = malloc(points * sizeof(double));
+    ref = malloc(points * sizeof(double));
+    out = malloc(points * sizeof(double));
+    if(!lat || !lon || !to_lat || !to_lon || !ref || !out)
+    {
+        fprintf(stderr, "gmath_bench: out of memory\n");
+        return 1;
+    }
+
+    srand(1);
+    walk(lat, lon, points);
+    ok = bench("track legs", lat, lon, lat + 1, lon + 1, points - 1, ref, out);
+
+    start = now();
+    total = nmea_track_length(lat, lon, points, out);
+    rate = (points - 1) / (now() - start);
+    for(i = 0; i < points - 1; ++i)
+        sum += ref[i];
+    printf("  nmea_track_length:             %10.0f legs/sec, %.1f m (ellipsoid %.1f m)\n", rate, total, sum);
+
+    scatter(lat, lon, points);
+    scatter(to_lat, to_lon, points);
+    ok &= bench("random pairs", lat, lon, to_lat, to_lon, points, ref, out);
+
+    if(!ok)
+    {
+        fprintf(stderr, "gmath_bench: batch ellipsoid distances differ\n");
+        return 1;
+    }
+
+    return 0;
+}
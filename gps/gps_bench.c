@@ -0,0 +1,633 @@
+/*
+ * GPS HAL load benchmark (host tool)
+ *
+ * Feeds the sentences of an NMEA library generator to the real gpslib.c
+ * reader through a pseudo-terminal, at the rate of a receiver, and
+ * reports the CPU time the HAL takes per sentence, the latency from the
+ * write of an epoch to its location_cb and of every sentence to its
+ * nmea_cb, and the allocations made while the session runs.
+ *
+ * gpslib.c is built into the tool with GPS_TTYPORT pointing at a link
+ * to the pty. Satellites beyond the 12 of nmeaINFO are sent as GLONASS
+ * and Galileo GSV sets. With limits given, exits 1 if one is exceeded
+ * or if any sentence or fix is lost, so it can gate regressions.
+ *
+ * With -p ubx it simulates a u-blox receiver instead: every epoch goes
+ * out as a UBX NAV-PVT and NAV-SAT and the HAL reads it with
+ * debug.gps.protocol set to ubx. The figures are then per message.
+ *
+ * Usage: gps_bench [-g noise|static|rotate|satrotate|randmove] [-r hz]
+ *                  [-s svs] [-t seconds] [-p nmea|ubx]
+ *                  [-C max_cpu_us_per_sentence] [-L max_p99_fix_latency_ms]
+ *                  [-A max_allocations]
+ */
+
+#include <hardware/gps.h>
+#include <cutils/properties.h>
+#include "nmea/nmea/nmea.h"
+#include "nmea/nmea/tok.h"
+#include "gpsubx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RATE      (1)
+#define BENCH_SECONDS   (10)
+#define BENCH_MAX_RATE  (50)
+#define BENCH_MAX_SVS   (40)
+#define BENCH_EPOCH_MAX (2048)      /* Bytes of one generated epoch at most */
+#define BENCH_START_MS  (300)       /* Time the reader gets to open the port */
+#define BENCH_DRAIN_MS  (500)       /* Time the HAL gets after the last epoch */
+#define BENCH_LEARN     (1)         /* Epochs the assembler learns the sentence set from */
+#define BENCH_EPOCH_NMEA (32)       /* nmea_cb calls of one epoch at most */
+
+extern const GpsInterface* gps__get_gps_interface(struct gps_device_t* dev);
+extern uint32_t nmeaSentences;
+extern uint32_t slotOverruns;
+extern uint32_t heapAllocs;
+
+static const char *gen_names[NMEA_GEN_LAST] = {
+    "noise", "static", "rotate", "satstatic", "satrotate", "randmove"
+};
+
+/* The epochs as they go out, one after another in epoch_buf */
+static char *epoch_buf;
+static int *epoch_off;
+static int epochs;
+static int rate;
+static int64_t base_utc;
+static int sentences_fed;
+static int ubx;
+
+/* Filled in by the writer, read by the callbacks */
+static volatile uint64_t *write_us;
+
+static double *fix_latency;
+static volatile int fixes;
+static double *nmea_latency;
+static volatile int nmea_count;
+static volatile int sv_reports;
+
+/* Allocations counted while the session runs, see -Wl,--wrap=malloc */
+static volatile int count_allocs;
+static volatile uint32_t allocs;
+static volatile uint64_t alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static void count_alloc(size_t size)
+{
+    if(count_allocs)
+    {
+        __sync_fetch_and_add(&allocs, 1);
+        __sync_fetch_and_add(&alloc_bytes, size);
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    count_alloc(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    count_alloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __real_realloc(ptr, size);
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t cpu_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t process_cpu_us(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+        ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void quiet(const char *str, int str_size)
+{
+}
+
+/* Epoch of a timestamp the HAL gave a callback, -1 if none */
+static int epoch_of(GpsUtcTime timestamp)
+{
+    int64_t idx = ((timestamp - base_utc) * rate + 500) / 1000;
+    return (idx >= 0 && idx < epochs) ? (int)idx : -1;
+}
+
+/* The first epochs wait for the next one to start, they are left out */
+static void location_cb(GpsLocation *loc)
+{
+    int idx = epoch_of(loc->timestamp);
+    if(idx >= BENCH_LEARN && write_us[idx] != 0 && fixes < epochs)
+        fix_latency[fixes++] = (now_us() - write_us[idx]) / 1000.0;
+}
+
+static void nmea_cb(GpsUtcTime timestamp, const char *nmea, int length)
+{
+    int idx = epoch_of(timestamp);
+    if(idx >= BENCH_LEARN && write_us[idx] != 0 && nmea_count < epochs * BENCH_EPOCH_NMEA)
+        nmea_latency[nmea_count++] = (now_us() - write_us[idx]) / 1000.0;
+}
+
+static void status_cb(GpsStatus *status)
+{
+}
+
+static void sv_status_cb(GpsSvStatus *sv_info)
+{
+    sv_reports++;
+}
+
+static void set_capabilities_cb(uint32_t capabilities)
+{
+}
+
+static void wakelock_cb(void)
+{
+}
+
+static pthread_t create_thread_cb(const char *name, void (*start)(void *), void *arg)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, (void *(*)(void *))start, arg);
+    return thread;
+}
+
+static GpsCallbacks callbacks = {
+    sizeof(GpsCallbacks),
+    location_cb,
+    status_cb,
+    sv_status_cb,
+    nmea_cb,
+    set_capabilities_cb,
+    wakelock_cb,
+    wakelock_cb,
+    create_thread_cb,
+};
+
+/* Gives a generated $GP sentence another talker and fixes its checksum */
+static void retalk(char *buff, int len, const char *talker)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char *star = memchr(buff, '*', len);
+    int crc;
+
+    buff[1] = talker[0];
+    buff[2] = talker[1];
+    if(star && star + 2 < buff + len)
+    {
+        crc = nmea_calc_crc(buff + 1, (int)(star - buff) - 1);
+        star[1] = hex[(crc >> 4) & 0xF];
+        star[2] = hex[crc & 0xF];
+    }
+}
+
+/* Satellite k of a second system, made up from those of GPS */
+static void extra_sat(const nmeaINFO *info, int sys, int k, nmeaSATELLITE *sat)
+{
+    int ngps = info->satinfo.inview > 0 ? info->satinfo.inview : 1;
+    const nmeaSATELLITE *gps = &info->satinfo.sat[k % ngps];
+
+    sat->id = (sys == NMEA_SYS_GLONASS) ? 65 + k : 1 + k;
+    sat->in_use = gps->in_use;
+    sat->elv = gps->elv;
+    sat->azimuth = (gps->azimuth + 120 * sys + 7 * k) % 360;
+    sat->sig = gps->sig;
+}
+
+/* The GSV set of a second system, its satellites follow those of GPS */
+static int extra_gsv(char *buff, int buff_sz, const nmeaINFO *info, int sys, int nsat)
+{
+    nmeaGPGSV pack;
+    int len = 0, isat, ipack, npack = (nsat + NMEA_SATINPACK - 1) / NMEA_SATINPACK;
+
+    for(ipack = 0; ipack < npack && len < buff_sz; ++ipack)
+    {
+        memset(&pack, 0, sizeof(pack));
+        pack.pack_count = npack;
+        pack.pack_index = ipack;
+        pack.sat_count = nsat;
+        for(isat = 0; isat < NMEA_SATINPACK && ipack * NMEA_SATINPACK + isat < nsat; ++isat)
+            extra_sat(info, sys, ipack * NMEA_SATINPACK + isat, &pack.sat_data[isat]);
+        isat = nmea_gen_GPGSV(buff + len, buff_sz - len, &pack);
+        retalk(buff + len, isat, (sys == NMEA_SYS_GLONASS) ? "GL" : "GA");
+        len += isat;
+    }
+
+    return len;
+}
+
+static void put_u2(unsigned char *p, unsigned int value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void put_u4(unsigned char *p, uint32_t value)
+{
+    put_u2(p, value & 0xFFFF);
+    put_u2(p + 2, value >> 16);
+}
+
+/* NAV-PVT of an epoch, see the u-blox 8 protocol description */
+static int ubx_pvt(char *buff, int buff_sz, const nmeaINFO *info)
+{
+    unsigned char p[UBX_NAV_PVT_LEN];
+    int fix = (info->sig > 0 && info->fix >= NMEA_FIX_2D);
+
+    memset(p, 0, sizeof(p));
+    put_u2(p + 4, info->utc.year + 1900);
+    p[6] = info->utc.mon + 1;
+    p[7] = info->utc.day;
+    p[8] = info->utc.hour;
+    p[9] = info->utc.min;
+    p[10] = info->utc.sec;
+    p[11] = 0x07;                       /* Date and time valid and resolved */
+    put_u4(p + 16, info->utc.hsec * 10000000);
+    p[20] = fix ? info->fix : 0;
+    p[21] = fix ? 0x01 : 0;             /* gnssFixOK */
+    p[23] = info->satinfo.inuse;
+    put_u4(p + 24, (uint32_t)(int32_t)floor(nmea_ndeg2degree(info->lon) * 1e7 + 0.5));
+    put_u4(p + 28, (uint32_t)(int32_t)floor(nmea_ndeg2degree(info->lat) * 1e7 + 0.5));
+    put_u4(p + 32, (uint32_t)(int32_t)(info->elv * 1000));
+    put_u4(p + 36, (uint32_t)(int32_t)(info->elv * 1000));
+    put_u4(p + 40, (uint32_t)(nmea_dop2meters(info->HDOP) * 1000));
+    put_u4(p + 60, (uint32_t)(int32_t)(info->speed / NMEA_TUS_MS * 1000));
+    put_u4(p + 64, (uint32_t)(int32_t)(info->direction * 1e5));
+    put_u2(p + 76, (unsigned int)(info->PDOP * 100));
+
+    return ubxWriteFrame((unsigned char *)buff, buff_sz, UBX_CLASS_NAV, UBX_NAV_PVT, p, sizeof(p));
+}
+
+static void ubx_sat_block(unsigned char *p, int gnss, int sv, const nmeaSATELLITE *sat)
+{
+    p[0] = gnss;
+    p[1] = sv;
+    p[2] = sat->sig;
+    p[3] = (unsigned char)(signed char)sat->elv;
+    put_u2(p + 4, sat->azimuth);
+    put_u4(p + 8, sat->in_use ? 0x0F : 0x04);   /* svUsed and quality */
+}
+
+/* NAV-SAT of an epoch, satellites past those of GPS as GLONASS and Galileo */
+static int ubx_sat(char *buff, int buff_sz, const nmeaINFO *info, int nextra)
+{
+    unsigned char p[UBX_NAV_SAT_HEADER + BENCH_MAX_SVS * UBX_NAV_SAT_BLOCK];
+    nmeaSATELLITE sat;
+    int it, num = 0, nglo = (nextra + 1) / 2;
+
+    memset(p, 0, sizeof(p));
+    p[4] = 1;
+    for(it = 0; it < info->satinfo.inview && it < NMEA_MAXSAT; ++it, ++num)
+        ubx_sat_block(p + UBX_NAV_SAT_HEADER + num * UBX_NAV_SAT_BLOCK,
+            UBX_GNSS_GPS, info->satinfo.sat[it].id, &info->satinfo.sat[it]);
+    for(it = 0; it < nextra; ++it, ++num)
+    {
+        int sys = (it < nglo) ? NMEA_SYS_GLONASS : NMEA_SYS_GALILEO;
+        int k = (it < nglo) ? it : it - nglo;
+
+        extra_sat(info, sys, k, &sat);
+        ubx_sat_block(p + UBX_NAV_SAT_HEADER + num * UBX_NAV_SAT_BLOCK,
+            (sys == NMEA_SYS_GLONASS) ? UBX_GNSS_GLONASS : UBX_GNSS_GALILEO, 1 + k, &sat);
+    }
+    p[5] = num;
+
+    return ubxWriteFrame((unsigned char *)buff, buff_sz, UBX_CLASS_NAV, UBX_NAV_SAT,
+        p, UBX_NAV_SAT_HEADER + num * UBX_NAV_SAT_BLOCK);
+}
+
+static void set_svs(nmeaINFO *info, int svs)
+{
+    int it;
+
+    info->satinfo.inview = info->satinfo.inuse = svs;
+    for(it = 0; it < svs; ++it)
+    {
+        info->satinfo.sat[it].id = it + 1;
+        info->satinfo.sat[it].in_use = 1;
+        info->satinfo.sat[it].elv = 10 + (it * 37) % 80;
+        info->satinfo.sat[it].azimuth = (it * 360) / svs;
+        info->satinfo.sat[it].sig = 30 + (it * 13) % 20;
+    }
+}
+
+static void utc_of(int64_t ms, nmeaTIME *utc)
+{
+    time_t sec = (time_t)(ms / 1000);
+    struct tm tm;
+
+    gmtime_r(&sec, &tm);
+    utc->year = tm.tm_year;
+    utc->mon = tm.tm_mon;
+    utc->day = tm.tm_mday;
+    utc->hour = tm.tm_hour;
+    utc->min = tm.tm_min;
+    utc->sec = tm.tm_sec;
+    utc->hsec = (int)(ms % 1000) / 10;
+}
+
+static int count_lines(const char *buff, int len)
+{
+    int lines = 0;
+    while(len-- > 0)
+        lines += (*buff++ == '\n');
+    return lines;
+}
+
+/* All epochs are generated up front, so the run only costs the HAL */
+static int generate(int type, int svs)
+{
+    nmeaGENERATOR *gen;
+    nmeaINFO info;
+    int i, len = 0, ngps = svs, nextra;
+
+    epoch_buf = malloc((size_t)epochs * BENCH_EPOCH_MAX);
+    epoch_off = malloc((epochs + 1) * sizeof(int));
+    if(!epoch_buf || !epoch_off)
+        return 0;
+
+    nmea_zero_INFO(&info);
+    if(0 == (gen = nmea_create_generator(type, &info)))
+        return 0;
+    if(ngps > NMEA_MAXSAT)
+        ngps = NMEA_MAXSAT;
+    if(svs > 0)
+        set_svs(&info, ngps);
+    nextra = (svs > ngps) ? svs - ngps : 0;
+
+    for(i = 0; i < epochs; ++i)
+    {
+        char *buff = epoch_buf + len;
+        int n;
+
+        nmea_gen_loop(gen, &info);
+        utc_of(base_utc + (int64_t)i * 1000 / rate, &info.utc);
+        if(ubx)
+        {
+            n = ubx_pvt(buff, BENCH_EPOCH_MAX, &info);
+            n += ubx_sat(buff + n, BENCH_EPOCH_MAX - n, &info, nextra);
+            epoch_off[i] = len;
+            sentences_fed += 2;
+            len += n;
+            continue;
+        }
+        n = nmea_generate(buff, BENCH_EPOCH_MAX, &info, GPGGA | GPGSA | GPGSV | GPRMC | GPVTG);
+        if(nextra > 0)
+        {
+            n += extra_gsv(buff + n, BENCH_EPOCH_MAX - n, &info, NMEA_SYS_GLONASS, (nextra + 1) / 2);
+            if(nextra > 1)
+                n += extra_gsv(buff + n, BENCH_EPOCH_MAX - n, &info, NMEA_SYS_GALILEO, nextra / 2);
+        }
+        epoch_off[i] = len;
+        sentences_fed += count_lines(buff, n);
+        len += n;
+    }
+    epoch_off[epochs] = len;
+
+    nmea_destroy_generator(gen);
+    return 1;
+}
+
+static int master_fd = -1;
+static uint64_t writer_cpu;
+
+/* Writes every epoch on its due time, as a receiver would */
+static void *writer(void *arg)
+{
+    uint64_t start = now_us(), cpu = cpu_us(CLOCK_THREAD_CPUTIME_ID);
+    int i;
+
+    for(i = 0; i < epochs; ++i)
+    {
+        uint64_t due = start + (uint64_t)i * 1000000 / rate;
+        uint64_t now = now_us();
+        int off = epoch_off[i], len = epoch_off[i + 1] - epoch_off[i];
+
+        if(due > now)
+            usleep((useconds_t)(due - now));
+        write_us[i] = now_us();
+        while(len > 0)
+        {
+            ssize_t got = write(master_fd, epoch_buf + off, len);
+            if(got < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                perror("gps_bench: pty write");
+                return NULL;
+            }
+            off += got;
+            len -= got;
+        }
+    }
+
+    writer_cpu = cpu_us(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *values, int count, int percent)
+{
+    int idx;
+    if(count == 0)
+        return 0;
+    idx = (count * percent + 99) / 100 - 1;
+    return values[idx < 0 ? 0 : idx];
+}
+
+static void print_latency(const char *name, double *values, int count)
+{
+    qsort(values, count, sizeof(double), compare);
+    printf("  %-12s latency ms: p50 %.3f p90 %.3f p99 %.3f max %.3f (%d)\n", name,
+        percentile(values, count, 50), percentile(values, count, 90),
+        percentile(values, count, 99), count ? values[count - 1] : 0, count);
+}
+
+static int open_pty(void)
+{
+    char *slave;
+
+    master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master_fd < 0 || grantpt(master_fd) != 0 || unlockpt(master_fd) != 0 ||
+        0 == (slave = ptsname(master_fd)))
+    {
+        perror("gps_bench: pty");
+        return 0;
+    }
+
+    unlink(GPS_TTYPORT);
+    if(symlink(slave, GPS_TTYPORT) != 0)
+    {
+        perror("gps_bench: " GPS_TTYPORT);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const GpsInterface *gps;
+    pthread_t thread;
+    int type = NMEA_GEN_ROTATE, svs = 0, seconds = BENCH_SECONDS;
+    double max_cpu = 0, max_p99 = 0, cpu_per;
+    long max_allocs = -1;
+    uint64_t cpu;
+    int opt, failed = 0;
+
+    rate = BENCH_RATE;
+    while((opt = getopt(argc, argv, "g:r:s:t:p:C:L:A:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'g':
+            for(type = 0; type < NMEA_GEN_LAST && strcmp(optarg, gen_names[type]); ++type)
+                ;
+            break;
+        case 'r': rate = atoi(optarg); break;
+        case 's': svs = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'p':
+            ubx = (strcmp(optarg, "ubx") == 0);
+            if(!ubx && strcmp(optarg, "nmea") != 0)
+                type = NMEA_GEN_LAST;
+            break;
+        case 'C': max_cpu = atof(optarg); break;
+        case 'L': max_p99 = atof(optarg); break;
+        case 'A': max_allocs = atol(optarg); break;
+        default: type = NMEA_GEN_LAST; break;
+        }
+    }
+    if(type >= NMEA_GEN_LAST || rate < 1 || rate > BENCH_MAX_RATE ||
+        svs < 0 || svs > BENCH_MAX_SVS || seconds < 1)
+    {
+        fprintf(stderr, "usage: gps_bench [-g noise|static|rotate|satrotate|randmove] [-r 1-%d hz]\n"
+            "                 [-s 1-%d svs] [-t seconds] [-p nmea|ubx]\n"
+            "                 [-C max_cpu_us] [-L max_p99_ms] [-A max_allocs]\n",
+            BENCH_MAX_RATE, BENCH_MAX_SVS);
+        return 2;
+    }
+
+    nmea_property()->trace_func = &quiet;
+    nmea_property()->error_func = &quiet;
+
+    /* Whole seconds of today, the HAL dates sentences before an RMC by the clock */
+    base_utc = (int64_t)time(NULL) * 1000;
+    epochs = rate * seconds + BENCH_LEARN;
+    if(!generate(type, svs))
+    {
+        fprintf(stderr, "gps_bench: out of memory\n");
+        return 1;
+    }
+    write_us = calloc(epochs, sizeof(uint64_t));
+    fix_latency = malloc(epochs * sizeof(double));
+    nmea_latency = malloc(epochs * BENCH_EPOCH_NMEA * sizeof(double));
+    if(!write_us || !fix_latency || !nmea_latency)
+    {
+        fprintf(stderr, "gps_bench: out of memory\n");
+        return 1;
+    }
+
+    property_set("debug.gps.protocol", ubx ? "ubx" : "nmea");
+    mkdir(GPS_CAPTURE_DIR, 0770);
+    if(!open_pty())
+        return 1;
+
+    gps = gps__get_gps_interface(NULL);
+    if(gps->init(&callbacks) != 0)
+    {
+        fprintf(stderr, "gps_bench: init failed\n");
+        return 1;
+    }
+    gps->set_position_mode(GPS_POSITION_MODE_STANDALONE, GPS_POSITION_RECURRENCE_PERIODIC, 0, 0, 0);
+
+    count_allocs = 1;
+    cpu = process_cpu_us();
+    gps->start();
+    usleep(BENCH_START_MS * 1000);
+
+    pthread_create(&thread, NULL, writer, NULL);
+    pthread_join(thread, NULL);
+    usleep(BENCH_DRAIN_MS * 1000);
+
+    gps->stop();
+    usleep(BENCH_DRAIN_MS * 1000);
+    cpu = process_cpu_us() - cpu - writer_cpu;
+    count_allocs = 0;
+    gps->cleanup();
+
+    cpu_per = sentences_fed ? (double)cpu / sentences_fed : 0;
+    printf("gps_bench: %s, %s, %d Hz, %d SVs, %d s\n", gen_names[type], ubx ? "ubx" : "nmea",
+        rate, svs, seconds);
+    printf("  epochs %d, %s fed %d, parsed %u, slot overruns %u\n",
+        epochs, ubx ? "messages" : "sentences", sentences_fed, nmeaSentences, slotOverruns);
+    printf("  location_cb %d, nmea_cb %d, sv_status_cb %d\n", fixes, nmea_count, sv_reports);
+    printf("  cpu %.2f us/%s (%.1f ms total), %.2f us/epoch\n", cpu_per,
+        ubx ? "message" : "sentence", cpu / 1000.0, (double)cpu / epochs);
+    print_latency("location_cb", fix_latency, fixes);
+    print_latency("nmea_cb", nmea_latency, nmea_count);
+    printf("  allocations %u (%llu bytes), %u by gpsAlloc\n",
+        allocs, (unsigned long long)alloc_bytes, heapAllocs);
+
+    if(slotOverruns != 0 || nmeaSentences != (uint32_t)sentences_fed || fixes != epochs - BENCH_LEARN)
+    {
+        fprintf(stderr, "gps_bench: lost sentences or fixes\n");
+        failed = 1;
+    }
+    if(max_cpu > 0 && cpu_per > max_cpu)
+    {
+        fprintf(stderr, "gps_bench: cpu %.2f us/sentence over %.2f\n", cpu_per, max_cpu);
+        failed = 1;
+    }
+    if(max_p99 > 0 && percentile(fix_latency, fixes, 99) > max_p99)
+    {
+        fprintf(stderr, "gps_bench: p99 fix latency over %.3f ms\n", max_p99);
+        failed = 1;
+    }
+    if(max_allocs >= 0 && allocs > (uint32_t)max_allocs)
+    {
+        fprintf(stderr, "gps_bench: %u allocations over %ld\n", allocs, max_allocs);
+        failed = 1;
+    }
+
+    close(master_fd);
+    unlink(GPS_TTYPORT);
+    return failed;
+}
@@ -0,0 +1,200 @@
+// NI Adam GPS library
+// Constant velocity Kalman filter for the fixes of the receiver
+
+#include <math.h>
+#include <string.h>
+#include "gpsfilter.h"
+#include "nmea/nmea/gmath.h"
+
+// Acceleration the track may take, 1 sigma in m/s^2
+#define FILTER_ACCEL 2.0
+// Speed over ground error at HDOP 1, 1 sigma in m/s
+#define FILTER_SPEED_SIGMA 0.5
+// HDOP of fixes without one (RMC only)
+#define FILTER_HDOP 2.0
+// Velocity error before the receiver gave a speed, 1 sigma in m/s
+#define FILTER_VEL_SEED 10.0
+// A longer gap between fixes starts over
+#define FILTER_MAX_GAP_MS 30000
+// Fixes further off the prediction (squared sigmas of both axes) are refused
+#define FILTER_GATE 25.0
+// After that many refused in a row the receiver is believed
+#define FILTER_MAX_REJECTS 3
+// The plane is moved under the position before it strays further
+#define FILTER_RECENTER_M 5000.0
+// Below it the bearing of the receiver is kept
+#define FILTER_BEARING_SPEED 0.5
+
+static void setOrigin(gpsFilter *filter, double lat, double lon) {
+	double e2 = NMEA_EARTH_FLATTENING * (2 - NMEA_EARTH_FLATTENING);
+	double s = sin(lat);
+	double w = sqrt(1 - e2 * s * s);
+
+	filter->lat0 = lat;
+	filter->lon0 = lon;
+	// Meridian and prime vertical radius of curvature
+	filter->mLat = NMEA_EARTH_SEMIMAJORAXIS_M * (1 - e2) / (w * w * w);
+	filter->mLon = NMEA_EARTH_SEMIMAJORAXIS_M / w * cos(lat);
+}
+
+static double wrapLon(double lon) {
+	if (lon > NMEA_PI)
+		return lon - 2 * NMEA_PI;
+	if (lon < -NMEA_PI)
+		return lon + 2 * NMEA_PI;
+	return lon;
+}
+
+// Splits speed and bearing of the fix into east and north, returns 0 if it has none
+static int fixVelocity(const GpsLocation *loc, double vel[2]) {
+	if ((loc->flags & (GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING)) !=
+		(GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING))
+		return 0;
+	vel[0] = loc->speed * sin(loc->bearing * NMEA_PI180);
+	vel[1] = loc->speed * cos(loc->bearing * NMEA_PI180);
+	return 1;
+}
+
+static void seed(gpsFilter *filter, const GpsLocation *loc, double r, double rv) {
+	int axis;
+	double vel[2] = { 0, 0 };
+
+	if (!fixVelocity(loc, vel))
+		rv = FILTER_VEL_SEED * FILTER_VEL_SEED;
+	setOrigin(filter, loc->latitude * NMEA_PI180, loc->longitude * NMEA_PI180);
+	for (axis = 0; axis < 2; axis++) {
+		filter->pos[axis] = 0;
+		filter->vel[axis] = vel[axis];
+		filter->pp[axis] = r;
+		filter->pv[axis] = 0;
+		filter->vv[axis] = rv;
+	}
+	filter->valid = 1;
+	filter->rejects = 0;
+	filter->time = loc->timestamp;
+}
+
+static void predict(gpsFilter *filter, double dt) {
+	double q = FILTER_ACCEL * FILTER_ACCEL;
+	double dt2 = dt * dt;
+	int axis;
+
+	for (axis = 0; axis < 2; axis++) {
+		filter->pos[axis] += filter->vel[axis] * dt;
+		filter->pp[axis] += dt * (2 * filter->pv[axis] + dt * filter->vv[axis]) + q * dt2 * dt2 / 4;
+		filter->pv[axis] += dt * filter->vv[axis] + q * dt2 * dt / 2;
+		filter->vv[axis] += q * dt2;
+	}
+}
+
+static void measurePosition(gpsFilter *filter, int axis, double z, double r) {
+	double s = filter->pp[axis] + r;
+	double kp = filter->pp[axis] / s;
+	double kv = filter->pv[axis] / s;
+	double y = z - filter->pos[axis];
+
+	filter->pos[axis] += kp * y;
+	filter->vel[axis] += kv * y;
+	filter->vv[axis] -= kv * filter->pv[axis];
+	filter->pp[axis] *= 1 - kp;
+	filter->pv[axis] *= 1 - kp;
+}
+
+static void measureVelocity(gpsFilter *filter, int axis, double z, double r) {
+	double s = filter->vv[axis] + r;
+	double kp = filter->pv[axis] / s;
+	double kv = filter->vv[axis] / s;
+	double y = z - filter->vel[axis];
+
+	filter->pos[axis] += kp * y;
+	filter->vel[axis] += kv * y;
+	filter->pp[axis] -= kp * filter->pv[axis];
+	filter->pv[axis] *= 1 - kv;
+	filter->vv[axis] *= 1 - kv;
+}
+
+void gpsFilterReset(gpsFilter *filter) {
+	memset(filter, 0, sizeof(*filter));
+}
+
+// Starts the filter at a position known from elsewhere, accuracy is its
+// 1 sigma radius in meters at UTC time. The velocity is left unknown.
+void gpsFilterAid(gpsFilter *filter, double latitude, double longitude,
+	double accuracy, GpsUtcTime time) {
+	GpsLocation loc;
+
+	memset(&loc, 0, sizeof(loc));
+	loc.flags = GPS_LOCATION_HAS_LAT_LONG;
+	loc.latitude = latitude;
+	loc.longitude = longitude;
+	loc.timestamp = time;
+	seed(filter, &loc, accuracy * accuracy / 2, 0);
+}
+
+// Takes the fix in loc and replaces its position with the filtered one,
+// its speed and bearing too if it has them. The accuracy becomes the 1
+// sigma radius of the filtered position. hdop is 0 if the fix has none.
+// Returns 0 if loc has no position to filter.
+int gpsFilterUpdate(gpsFilter *filter, GpsLocation *loc, double hdop) {
+	double sigma, r, rv, dt, z[2], vel[2], nis;
+	int axis;
+
+	if (!(loc->flags & GPS_LOCATION_HAS_LAT_LONG))
+		return 0;
+
+	if (hdop <= 0)
+		hdop = FILTER_HDOP;
+	// Variance of each axis, nmea_dop2meters gives the horizontal radius
+	sigma = nmea_dop2meters(hdop);
+	r = sigma * sigma / 2;
+	rv = FILTER_SPEED_SIGMA * hdop * FILTER_SPEED_SIGMA * hdop;
+
+	dt = (loc->timestamp - filter->time) / 1000.0;
+	if (!filter->valid || dt < 0 || dt * 1000 > FILTER_MAX_GAP_MS) {
+		seed(filter, loc, r, rv);
+	} else {
+		predict(filter, dt);
+		filter->time = loc->timestamp;
+
+		z[0] = wrapLon(loc->longitude * NMEA_PI180 - filter->lon0) * filter->mLon;
+		z[1] = (loc->latitude * NMEA_PI180 - filter->lat0) * filter->mLat;
+		nis = 0;
+		for (axis = 0; axis < 2; axis++) {
+			double y = z[axis] - filter->pos[axis];
+			nis += y * y / (filter->pp[axis] + r);
+		}
+		if (nis <= FILTER_GATE) {
+			filter->rejects = 0;
+			for (axis = 0; axis < 2; axis++)
+				measurePosition(filter, axis, z[axis], r);
+			if (fixVelocity(loc, vel)) {
+				for (axis = 0; axis < 2; axis++)
+					measureVelocity(filter, axis, vel[axis], rv);
+			}
+		} else if (++filter->rejects >= FILTER_MAX_REJECTS) {
+			// No multipath jump, the receiver keeps insisting
+			seed(filter, loc, r, rv);
+		}
+		// Refused fixes leave the prediction
+	}
+
+	if (fabs(filter->pos[0]) > FILTER_RECENTER_M || fabs(filter->pos[1]) > FILTER_RECENTER_M) {
+		setOrigin(filter, filter->lat0 + filter->pos[1] / filter->mLat,
+			wrapLon(filter->lon0 + filter->pos[0] / filter->mLon));
+		filter->pos[0] = filter->pos[1] = 0;
+	}
+
+	loc->latitude = (filter->lat0 + filter->pos[1] / filter->mLat) / NMEA_PI180;
+	loc->longitude = wrapLon(filter->lon0 + filter->pos[0] / filter->mLon) / NMEA_PI180;
+	loc->flags |= GPS_LOCATION_HAS_ACCURACY;
+	loc->accuracy = sqrt(filter->pp[0] + filter->pp[1]);
+	if (loc->flags & GPS_LOCATION_HAS_SPEED) {
+		loc->speed = hypot(filter->vel[0], filter->vel[1]);
+		if ((loc->flags & GPS_LOCATION_HAS_BEARING) && loc->speed >= FILTER_BEARING_SPEED) {
+			loc->bearing = atan2(filter->vel[0], filter->vel[1]) / NMEA_PI180;
+			if (loc->bearing < 0)
+				loc->bearing += 360;
+		}
+	}
+	return 1;
+}
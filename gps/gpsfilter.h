@@ -0,0 +1,29 @@
+// NI Adam GPS library
+// Constant velocity Kalman filter for the fixes of the receiver
+
+#ifndef GPSFILTER_H
+#define GPSFILTER_H
+
+#include <hardware/gps.h>
+
+// East and north are filtered apart, each as position and velocity in
+// meters on a plane touching the earth at the origin. Everything is in
+// the struct, an update takes the same few dozen flops every epoch.
+typedef struct _gpsFilter
+{
+	char		valid;		// Holds a state, else the next fix seeds it
+	int		rejects;	// Fixes refused in a row by the gate
+	GpsUtcTime	time;		// Of the last fix
+	double		lat0, lon0;	// Origin of the plane, radians
+	double		mLat, mLon;	// Meters per radian of latitude and longitude there
+	double		pos[2];		// East, north in meters
+	double		vel[2];		// East, north in m/s
+	double		pp[2], pv[2], vv[2];	// Covariance of each axis
+} gpsFilter;
+
+void gpsFilterReset(gpsFilter *filter);
+void gpsFilterAid(gpsFilter *filter, double latitude, double longitude,
+	double accuracy, GpsUtcTime time);
+int gpsFilterUpdate(gpsFilter *filter, GpsLocation *loc, double hdop);
+
+#endif
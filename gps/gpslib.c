@@ -4,27 +4,84 @@
 
 #include <hardware/gps.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <android/log.h>
+#include <cutils/properties.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
 #include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <math.h>
 #include "nmea/nmea/nmea.h"
+#include "nmea/nmea/tok.h"
+#include "gpsfilter.h"
+#include "gpsstats.h"
+#include "gpsubx.h"
 
 //#define  GPS_DEBUG  1
 
 #define  LOG_TAG  "gps_adam"
+// Host builds (gps_bench) point the port and the data directory elsewhere
+#ifndef GPS_TTYPORT
 #define GPS_TTYPORT "/dev/ttyHS3"
+#endif
 #define MAX_NMEA_CHARS 85
 
-
-#define MASK_GSV_MSG1 0x0001
-#define MASK_GSV_MSG2 0x0002
-#define MASK_GSV_MSG3 0x0004
-
-//Mirror the define in nmea/nmea/info.h
-#define NMEA_MAXSATS (12)
+// Bytes pulled from the tty per read, a full 1 Hz burst fits easily
+#define TTY_READ_CHARS 2048
+
+// What the session's callbacks consume, see subscribe()
+#define SUB_NMEA 0x01		// Raw sentences for nmea_cb
+#define SUB_LOCATION 0x02	// Fixes for location_cb
+#define SUB_SV 0x04		// Satellites for sv_status_cb
+
+#define MS_PER_DAY (86400000LL)
+// Receivers hit by the GPS week rollover report dates 1024 weeks early
+#define GPS_ROLLOVER_MS (1024LL * 7 * MS_PER_DAY)
+// No fix is older than 2012-01-01 UTC
+#define GPS_MIN_UTC_MS (1325376000000LL)
+
+// Reports are due a little early, epochs don't arrive exactly on time
+#define SCHED_SLACK_MS 500
+// The reader listens again this long before a report is due, so a whole
+// 1 Hz epoch is assembled for it
+#define SCHED_WARMUP_MS 1500
+// Longest sleep of the idle reader, so a new schedule is picked up soon
+#define SCHED_MAX_SLEEP_MS 1000
+
+// Capture of the tty reads, see openCapture()
+#ifndef GPS_CAPTURE_DIR
+#define GPS_CAPTURE_DIR "/data/gps"
+#endif
+#define GPS_CAPTURE_FILE GPS_CAPTURE_DIR "/nmea.cap"
+#define GPS_CAPTURE_MAGIC "GPSCAP1\n"
+// Last good time and position, kept between sessions
+#define GPS_AIDING_FILE GPS_CAPTURE_DIR "/aiding"
+#define GPS_AIDING_MAGIC "GPSAID1\n"
+// Counters and histograms of the last session
+#define GPS_STATS_FILE GPS_CAPTURE_DIR "/stats"
+// A receiver keeps its ephemeris about this long, a start after an older fix is cold
+#define AIDING_WARM_MS (4LL * 3600 * 1000)
+// A stored position spreads out by this many m/s of its age
+#define AIDING_DRIFT 30.0
+
+// Sentence slots queued from the reader to the callback thread.
+// Must be a power of two. A UBX NAV-SAT is queued as up to 36 at once.
+#define NMEA_SLOTS 64
+
+// Satellites kept for all systems, only GPS_MAX_SVS of them are reported
+#define SAT_TABLE_SIZE (NMEA_NSYS * NMEA_MAXSATVIEW)
+
+// Epoch bit of a complete GSV set of one system, above the nmeaPACKTYPE bits
+#define EPOCH_GSV(sys) (0x100 << (sys))
 
 #if GPS_DEBUG
 #define LOGV(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
@@ -32,33 +89,270 @@
 #define LOGV(...) ((void)0)
 #endif
 
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
 static GpsInterface adamGpsInterface;
 static GpsCallbacks* adamGpsCallbacks;
 static pthread_t NMEAThread;
-char NMEA[MAX_NMEA_CHARS];
+static char readerRunning = 0;
+// Wakes the reader out of poll() when the session is stopped
+static int wakePipe[2] = { -1, -1 };
+
+// A capture file is GPS_CAPTURE_MAGIC, then a record and its bytes for
+// every read of the tty. A record without bytes starts a session.
+typedef struct _captureRecord
+{
+	uint32_t	delay;		// Microseconds since the previous record
+	uint16_t	len;		// Bytes that follow
+} __attribute__((packed)) captureRecord;
+
+// Only touched by the reader thread
+static int captureFD = -1;
+static struct timespec captureLast;
+// Replay thread feeding a capture file to the reader through a pty
+static pthread_t replayThread;
+static char replayRunning = 0;
+static int replayPty = -1;
+static FILE *replayFile = NULL;
+static char replayFast = 0;
 pthread_mutex_t mutGPS = PTHREAD_MUTEX_INITIALIZER;
 char gpsOn = 0;
-GpsSvStatus *storeSV = NULL;
-int svMask = 0;
-pthread_mutex_t mutGSV = PTHREAD_MUTEX_INITIALIZER;
 
-pthread_mutex_t mutUseMask = PTHREAD_MUTEX_INITIALIZER;
-uint32_t useMask = 0;
-
-typedef struct _argsCarrier
+// Only touched by the callback thread, allocated once by gpslib_init
+static nmeaSATTAB satTab;
+// Smoothing of the fixes with debug.gps.filter set to 1, callback thread only
+static gpsFilter filter;
+static char filterOn = 0;
+
+// Set by gpslib_start() before the threads run: the SUB_* mask and the
+// nmeaPACKTYPE mask of sentences the reader parses for it
+static int subscription = 0;
+static int parseMask = 0;
+
+// Last good time and position. The time is set by the injections and by
+// every fix, the position only by a fix, both are kept in GPS_AIDING_FILE
+// between sessions. An injected position is held apart and never saved.
+// Under mutGPS.
+typedef struct _gpsAiding
+{
+	GpsUtcTime	time;		// UTC now is no earlier than, 0 if unknown
+	uint32_t	timeAt;		// monotonicMS() of time
+	char		timeLive;	// time was the UTC at timeAt, not just a bound
+	GpsUtcTime	fixTime;	// UTC of the position, 0 if none
+	double		latitude;
+	double		longitude;
+	double		altitude;
+	float		accuracy;
+	GpsUtcTime	injectTime;	// UTC of the injected position, 0 if none
+	double		injectLatitude;
+	double		injectLongitude;
+	float		injectAccuracy;
+} gpsAiding;
+
+// What GPS_AIDING_FILE holds after its magic
+typedef struct _aidingRecord
+{
+	GpsUtcTime	time;
+	GpsUtcTime	fixTime;
+	double		latitude;
+	double		longitude;
+	double		altitude;
+	float		accuracy;
+} aidingRecord;
+
+static gpsAiding aiding;
+// The session is the receiver's, a replay neither uses nor keeps aiding
+static char aidingOn = 0;
+
+// Time to first fix of the session, measured from gpslib_start()
+static uint32_t sessionStart = 0;
+static char ttffDone = 0;		// Callback thread
+static const char *ttffStart = "cold";	// What the session started from, see startClock()
+
+// Fix schedule from set_position_mode(). Times are monotonic milliseconds,
+// reportDue is moved by the callback thread and readerResume tells the
+// reader when to start reading the tty again.
+static volatile uint32_t schedInterval = 0;	// Between reports, 0 for every epoch
+static volatile char schedSingle = 0;		// Only report the first fix
+static volatile char reportDone = 0;		// The single fix was reported
+static volatile uint32_t reportDue = 0;
+static volatile uint32_t readerResume = 0;
+
+// Everything the receiver reported for one UTC time, delivered as a
+// single location_cb and sv_status_cb.
+typedef struct _gpsEpoch
 {
-	char* 		NMEA;
-	nmeaINFO*	info;
+	int		seen;		// nmeaPACKTYPE and EPOCH_GSV mask merged so far
+	char		timed;		// A GGA or RMC gave the epoch its time
+	char		fix;		// GGA or RMC reported a valid fix
+	float		hdop;		// Of the GGA, 0 without one
+	uint32_t	readUS;		// monotonicUS() of the read of its first timed sentence
+	nmeaTIME	utc;		// Time of day shared by the epoch's sentences
+	GpsLocation	loc;
+} gpsEpoch;
+
+static gpsEpoch epoch;
+static GpsSvStatus epochSV;
+static int epochMask = 0;		// Sentence set of the last full epoch
+static nmeaTIME lastEpochUTC;
+static char lastEpochValid = 0;
+
+typedef struct _nmeaSlot
+{
+	int		type;		// nmeaPACKTYPE of the sentence
+	int		talker;		// nmeaTALKER of the sentence
+	GpsUtcTime	time;
+	uint32_t	readUS;		// monotonicUS() of the tty read that completed it
+	uint32_t	parsedUS;	// and of the end of parseSlot()
+	float		accuracy;	// Receiver's own estimate in meters, 0 without one
+	int		len;		// 0 for a binary message until nmea_cb needs its text
+	char		NMEA[MAX_NMEA_CHARS + 2];
+	union {
+		nmeaGPGGA gga;
+		nmeaGPGSA gsa;
+		nmeaGPGSV gsv;
+		nmeaGPRMC rmc;
+		nmeaGPVTG vtg;
+	} pack;
+} nmeaSlot;
+
+// Single producer (reader thread), single consumer (callback thread) queue.
+// slotHead is only written by the reader, slotTail only by the callback thread.
+static nmeaSlot nmeaSlots[NMEA_SLOTS];
+static volatile unsigned int slotHead = 0;
+static volatile unsigned int slotTail = 0;
+static volatile char dispatchQuit = 0;
+static sem_t slotReady;
+static sem_t dispatchDone;
+// Date/time of the current session, advanced by every timed sentence
+static nmeaTIME sessionUTC;
+// Epoch milliseconds of the start of dayBaseDate, for getUTCTime()
+static nmeaTIME dayBaseDate;
+static GpsUtcTime dayBase;
+static char dayBaseValid = 0;
+// Dates before it are taken for a GPS week rollover, set each session
+static GpsUtcTime utcFloor = GPS_MIN_UTC_MS;
+
+// Sentence path counters, published on session end.
+// heapAllocs counts every gpsAlloc() made while a session is running.
+uint32_t nmeaSentences = 0;
+uint32_t slotOverruns = 0;
+uint32_t heapAllocs = 0;
+uint32_t checksumFails = 0;	// Sentences without a valid checksum
+uint32_t parseFails = 0;	// Sentences the parser refused
+uint32_t partialDrops = 0;	// Lines without a '$', overlong or never ended
+
+// Latencies in microseconds of each stage of a sentence: the tty read
+// that completed its line, found by frameNMEA(), parsed into a slot,
+// delivered by the callback thread. The first two are written by the
+// reader only, the others by the callback thread only, so none takes a
+// lock. Dumped to GPS_STATS_FILE on session end.
+static gpsHistogram histFrame = { "read_to_framed_us" };
+static gpsHistogram histParse = { "framed_to_parsed_us" };
+static gpsHistogram histQueue = { "parsed_to_delivered_us" };
+static gpsHistogram histTotal = { "read_to_delivered_us" };
+// From the read of the first timed sentence of an epoch to its location_cb
+static gpsHistogram histFix = { "fix_read_to_location_cb_us" };
+// Sentences queued for the callback thread, the new one included
+static gpsHistogram histDepth = { "queue_depth" };
+// monotonicUS() of the last tty read, reader only
+static uint32_t lastReadUS = 0;
+
+static void* gpsAlloc(size_t size) {
+	pthread_mutex_lock(&mutGPS);
+	if (gpsOn)
+		heapAllocs++;
+	pthread_mutex_unlock(&mutGPS);
+	return malloc(size);
+}
 
-} argsCarrier;
+static uint32_t monotonicMS() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Wraps after 71 minutes, only for differences
+static uint32_t monotonicUS() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Has the monotonic time passed when, wraps after 49 days
+static int timeReached(uint32_t when) {
+	return (int32_t)(monotonicMS() - when) >= 0;
+}
+
+static void publishCounters() {
+	char value[PROPERTY_VALUE_MAX];
+
+	LOGI("Session: %u sentences, %u slot overruns, %u heap allocations",
+		nmeaSentences, slotOverruns, heapAllocs);
+	snprintf(value, sizeof(value), "%u", nmeaSentences);
+	property_set("debug.gps.sentences", value);
+	snprintf(value, sizeof(value), "%u", slotOverruns);
+	property_set("debug.gps.slot_overruns", value);
+	snprintf(value, sizeof(value), "%u", heapAllocs);
+	property_set("debug.gps.heap_allocs", value);
+	LOGI("Dropped: %u bad checksums, %u parse failures, %u partial lines, %u GSV resets",
+		checksumFails, parseFails, partialDrops, satTab.gsv_resets);
+	snprintf(value, sizeof(value), "%u", checksumFails);
+	property_set("debug.gps.checksum_fails", value);
+	snprintf(value, sizeof(value), "%u", partialDrops);
+	property_set("debug.gps.partial_drops", value);
+	snprintf(value, sizeof(value), "%u", satTab.gsv_resets);
+	property_set("debug.gps.gsv_resets", value);
+	snprintf(value, sizeof(value), "%u", gpsHistogramPercentile(&histFix, 50) / 1000);
+	property_set("debug.gps.fix_latency_ms", value);
+}
+
+static void resetStats() {
+	nmeaSentences = 0;
+	slotOverruns = 0;
+	checksumFails = 0;
+	parseFails = 0;
+	partialDrops = 0;
+	gpsHistogramReset(&histFrame);
+	gpsHistogramReset(&histParse);
+	gpsHistogramReset(&histQueue);
+	gpsHistogramReset(&histTotal);
+	gpsHistogramReset(&histFix);
+	gpsHistogramReset(&histDepth);
+}
+
+// Both threads are done with the session when this runs
+static void dumpStats() {
+	FILE *out;
+
+	mkdir(GPS_CAPTURE_DIR, 0770);
+	out = fopen(GPS_STATS_FILE ".tmp", "w");
+	if (out == NULL) {
+		LOGE("Failed writing %s: %s", GPS_STATS_FILE, strerror(errno));
+		return;
+	}
+	fprintf(out, "sentences %u\n", nmeaSentences);
+	fprintf(out, "slot_overruns %u\n", slotOverruns);
+	fprintf(out, "heap_allocs %u\n", heapAllocs);
+	fprintf(out, "checksum_fails %u\n", checksumFails);
+	fprintf(out, "parse_fails %u\n", parseFails);
+	fprintf(out, "partial_drops %u\n", partialDrops);
+	fprintf(out, "gsv_resets %u\n", satTab.gsv_resets);
+	gpsHistogramDump(out, &histFrame);
+	gpsHistogramDump(out, &histParse);
+	gpsHistogramDump(out, &histQueue);
+	gpsHistogramDump(out, &histTotal);
+	gpsHistogramDump(out, &histFix);
+	gpsHistogramDump(out, &histDepth);
+	if (fclose(out) != 0 || rename(GPS_STATS_FILE ".tmp", GPS_STATS_FILE) != 0) {
+		LOGE("Failed writing %s", GPS_STATS_FILE);
+		unlink(GPS_STATS_FILE ".tmp");
+	}
+}
 
-typedef struct _nmeaArgs
-{
-	char* NMEA;
-	GpsUtcTime time;
-} nmeaArgs;
 /////////////////////////////////////////////////////////
 //			GPS THREAD		       //
 /////////////////////////////////////////////////////////
@@ -71,357 +365,1226 @@ static void updateStatus(void* arg) {
 }
 
 
+// Days from 1970-01-01 to a Gregorian date, month 1 - 12
+static int64_t daysFromCivil(int year, int mon, int day) {
+	int era, yoe, doy, doe;
+
+	year -= (mon <= 2);
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (int64_t)era * 146097 + doe - 719468;
+}
+
+static int timeOfDayMS(const nmeaTIME *time) {
+	return ((time->hour * 60 + time->min) * 60 + time->sec) * 1000 + time->hsec * 10;
+}
+
+// Milliseconds since the Unix epoch. Only the time of day is worked out
+// per sentence, the day base when the date changes.
 static GpsUtcTime getUTCTime(nmeaTIME *time) {
-	GpsUtcTime ret = time->year*(31556926);
-	ret += time->mon*(2629743);
-	ret += time->day*(86400);
-	ret += time->hour*(3600);
-	ret += time->min*(60);
-	ret += time->sec*(1);
-	ret *= 1000; // Scale up to milliseconds
-	ret += time->hsec*(10);
-	return ret;
-}
-
-static double convertCoord(double coord) {
-	// dddmm.mmm -> dddd.ddddd, etc
-	double degrees;
-	double mins = modf(coord/100.0f, &degrees);
-	degrees += mins*100.0/60.0f;
-	return degrees;
-}
-
-static void updateNMEA(void* arg) {
-	nmeaArgs *Args = (nmeaArgs*)arg;
-	GpsUtcTime time = Args->time;
-	char* NMEA2 = Args->NMEA;
-	//LOGV("Debug GPS: %s", NMEA2);
-	if (adamGpsCallbacks != NULL) {
-		adamGpsCallbacks->nmea_cb(time, NMEA2, strlen(NMEA2));
+	if (!dayBaseValid || time->year != dayBaseDate.year ||
+		time->mon != dayBaseDate.mon || time->day != dayBaseDate.day) {
+		dayBase = daysFromCivil(time->year + 1900, time->mon + 1, time->day) * MS_PER_DAY;
+		// A receiver past a GPS week rollover dates its fixes 1024 weeks early
+		while (dayBase < utcFloor)
+			dayBase += GPS_ROLLOVER_MS;
+		dayBaseDate = *time;
+		dayBaseValid = 1;
 	}
-	free(NMEA2);
-	free(arg);	
+	return dayBase + timeOfDayMS(time);
 }
 
-// No real need for this function.
-// GGA does the same and more.
-static void updateRMC(void* arg) {
-	argsCarrier *Args = (argsCarrier*)arg;
-	nmeaINFO *info = Args->info;
-	char* NMEA2 = Args->NMEA;
-	GpsLocation newLoc;
+static void nextDay(nmeaTIME *time) {
+	static const int monthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int year = time->year + 1900;
+	int leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
 
-	if (info->sig == 0) {
-		LOGV("No valid fix data.");
-		goto endRMC;
+	if (++time->day > monthDays[time->mon] + (time->mon == 1 && leap)) {
+		time->day = 1;
+		if (++time->mon > 11) {
+			time->mon = 0;
+			time->year++;
+		}
 	}
+}
 
-	newLoc.size = sizeof(GpsLocation);
-	newLoc.flags = GPS_LOCATION_HAS_LAT_LONG;
-	newLoc.latitude = convertCoord(info->lat);
-	newLoc.longitude = convertCoord(info->lon);
-	newLoc.timestamp = getUTCTime(&(info->utc));
-	LOGV("Lat: %lf Long: %lf", newLoc.latitude, newLoc.longitude);
-	if (adamGpsCallbacks != NULL) {
-		adamGpsCallbacks->location_cb(&newLoc);
-	}
-	endRMC:
-	free(info);
-	free(NMEA2);
-	free(arg);
+// Takes the time of day of a sentence without a date. A time far behind
+// the session's passed midnight, the date moves on until an RMC brings it.
+static void setTimeOfDay(const nmeaTIME *utc) {
+	if (timeOfDayMS(utc) + MS_PER_DAY / 2 < timeOfDayMS(&sessionUTC))
+		nextDay(&sessionUTC);
+	sessionUTC.hour = utc->hour;
+	sessionUTC.min = utc->min;
+	sessionUTC.sec = utc->sec;
+	sessionUTC.hsec = utc->hsec;
 }
 
-static void updateGSA(void* arg) {
-	argsCarrier *Args = (argsCarrier*)arg;
-	nmeaINFO *info = Args->info;
-	char* NMEA2 = Args->NMEA;
-	nmeaGPGSA *pack = malloc(sizeof(nmeaGPGSA));
-	nmea_parse_GPGSA(NMEA2, strlen(NMEA2), pack);
-	int count = 0;
-	pthread_mutex_lock(&mutUseMask);
-	useMask = 0;
-	for (count = 0; count < NMEA_MAXSATS; count++) {
-		if (pack->sat_prn[count] != 0)
-		{
-			LOGV("%i is in use", pack->sat_prn[count]);
-			useMask |= (1 << (pack->sat_prn[count]-1));
-		}
+// Takes the time of an RMC. Its date stays empty until the receiver knows it.
+static void setDateTime(const nmeaTIME *utc) {
+	if (utc->mon >= 0 && utc->mon <= 11 && utc->day >= 1 && utc->day <= 31)
+		sessionUTC = *utc;
+	else
+		setTimeOfDay(utc);
+}
+
+// UTC from the last live aiding time, 0 if there is none. Hold mutGPS.
+static GpsUtcTime aidingNow() {
+	if (!aiding.timeLive)
+		return 0;
+	return aiding.time + (uint32_t)(monotonicMS() - aiding.timeAt);
+}
+
+static GpsUtcTime systemUTC() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (GpsUtcTime)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void utcToTime(GpsUtcTime utc, nmeaTIME *time) {
+	time_t sec = (time_t)(utc / 1000);
+	struct tm tm;
+
+	gmtime_r(&sec, &tm);
+	time->year = tm.tm_year;
+	time->mon = tm.tm_mon;
+	time->day = tm.tm_mday;
+	time->hour = tm.tm_hour;
+	time->min = tm.tm_min;
+	time->sec = tm.tm_sec;
+	time->hsec = (int)(utc % 1000) / 10;
+}
+
+// Starts the date of the session, for sentences before the first RMC,
+// from an injected time or else from the system clock, but never before
+// the last time stored. A reset clock also no longer hides a rollover.
+// The start is "warm" after a real fix less than AIDING_WARM_MS old, the
+// receiver keeps its own almanac, else "cold" until aidFilter() says more.
+static GpsUtcTime startClock() {
+	GpsUtcTime utc, floor, fixTime;
+
+	utc = floor = fixTime = 0;
+	if (aidingOn) {
+		pthread_mutex_lock(&mutGPS);
+		utc = aidingNow();
+		floor = aiding.time;
+		fixTime = aiding.fixTime;
+		pthread_mutex_unlock(&mutGPS);
 	}
-	pthread_mutex_unlock(&mutUseMask);
 
-	endRMC:
-	free(pack);
-	free(info);
-	free(NMEA2);
-	free(arg);
+	if (utc == 0)
+		utc = systemUTC();
+	if (utc < floor)
+		utc = floor;
+	utcToTime(utc, &sessionUTC);
+	utcFloor = GPS_MIN_UTC_MS;
+	if (floor - GPS_ROLLOVER_MS / 2 > utcFloor)
+		utcFloor = floor - GPS_ROLLOVER_MS / 2;
+	dayBaseValid = 0;
+	ttffStart = (fixTime != 0 && utc - fixTime < AIDING_WARM_MS) ? "warm" : "cold";
+	return utc;
 }
 
-static void updateGGA(void* arg) {
-	argsCarrier *Args = (argsCarrier*)arg;
-	nmeaINFO *info = Args->info;
-	char* NMEA2 = Args->NMEA;
-	GpsLocation newLoc;
-	GpsStatus gpsStat;
+// Starts the filter at the last fix or the injected position, whichever
+// is more accurate by now. It helps if that is fresh, a fix after a longer
+// gap starts the filter over. A cold start seeded by an injected position
+// is an "aided" one.
+static void aidFilter(GpsUtcTime utc) {
+	gpsAiding aid;
+	double fixError = -1, injectError = -1;
 
-	gpsStat.size = sizeof(gpsStat);
-	if (info->sig == 0) {
-		LOGV("No valid fix data.");
-		goto endGGA;
+	pthread_mutex_lock(&mutGPS);
+	aid = aiding;
+	pthread_mutex_unlock(&mutGPS);
+
+	if (!aidingOn)
+		return;
+	if (aid.fixTime != 0 && aid.fixTime <= utc)
+		fixError = aid.accuracy + AIDING_DRIFT * (utc - aid.fixTime) / 1000.0;
+	if (aid.injectTime != 0 && aid.injectTime <= utc)
+		injectError = aid.injectAccuracy + AIDING_DRIFT * (utc - aid.injectTime) / 1000.0;
+
+	if (injectError >= 0 && (fixError < 0 || injectError < fixError)) {
+		gpsFilterAid(&filter, aid.injectLatitude, aid.injectLongitude, injectError, utc);
+		if (strcmp(ttffStart, "cold") == 0)
+			ttffStart = "aided";
+	} else if (fixError >= 0)
+		gpsFilterAid(&filter, aid.latitude, aid.longitude, fixError, utc);
+}
+
+// Callback thread: the last fix is the aiding of the next session
+static void keepFix(const GpsLocation *loc) {
+	if (!aidingOn)
+		return;
+	pthread_mutex_lock(&mutGPS);
+	aiding.time = loc->timestamp;
+	aiding.timeAt = monotonicMS();
+	aiding.timeLive = 1;
+	aiding.fixTime = loc->timestamp;
+	aiding.latitude = loc->latitude;
+	aiding.longitude = loc->longitude;
+	aiding.altitude = loc->altitude;
+	aiding.accuracy = (loc->flags & GPS_LOCATION_HAS_ACCURACY) ? loc->accuracy : 0;
+	pthread_mutex_unlock(&mutGPS);
+}
+
+static void reportTTFF() {
+	char value[PROPERTY_VALUE_MAX];
+	uint32_t ttff = monotonicMS() - sessionStart;
+
+	LOGI("TTFF: %u ms, %s start", ttff, ttffStart);
+	snprintf(value, sizeof(value), "%u", ttff);
+	property_set("debug.gps.ttff", value);
+	property_set("debug.gps.ttff_start", ttffStart);
+}
+
+static void loadAiding() {
+	char magic[sizeof(GPS_AIDING_MAGIC) - 1];
+	aidingRecord rec;
+	int fd;
+
+	fd = open(GPS_AIDING_FILE, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) &&
+		memcmp(magic, GPS_AIDING_MAGIC, sizeof(magic)) == 0 &&
+		read(fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec)) {
+		pthread_mutex_lock(&mutGPS);
+		// Only a bound after a reboot, the monotonic clock started over
+		aiding.time = rec.time;
+		aiding.timeLive = 0;
+		aiding.fixTime = rec.fixTime;
+		aiding.latitude = rec.latitude;
+		aiding.longitude = rec.longitude;
+		aiding.altitude = rec.altitude;
+		aiding.accuracy = rec.accuracy;
+		pthread_mutex_unlock(&mutGPS);
 	}
+	close(fd);
+}
 
-	newLoc.size = sizeof(GpsLocation);
-	newLoc.flags = GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE | GPS_LOCATION_HAS_ACCURACY;
-	newLoc.accuracy = info->HDOP;
-	newLoc.altitude = info->elv;
-	newLoc.latitude = convertCoord(info->lat);
-	newLoc.longitude = convertCoord(info->lon);
-	newLoc.timestamp = getUTCTime(&(info->utc));
-	LOGV("Lat: %lf Long: %lf", newLoc.latitude, newLoc.longitude);
-	if (adamGpsCallbacks != NULL) {
-		adamGpsCallbacks->location_cb(&newLoc);
+static void saveAiding() {
+	aidingRecord rec;
+	int fd, ok;
+
+	memset(&rec, 0, sizeof(rec));
+	pthread_mutex_lock(&mutGPS);
+	rec.time = aiding.timeLive ? aidingNow() : aiding.time;
+	rec.fixTime = aiding.fixTime;
+	rec.latitude = aiding.latitude;
+	rec.longitude = aiding.longitude;
+	rec.altitude = aiding.altitude;
+	rec.accuracy = aiding.accuracy;
+	pthread_mutex_unlock(&mutGPS);
+
+	mkdir(GPS_CAPTURE_DIR, 0770);
+	fd = open(GPS_AIDING_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (fd < 0) {
+		LOGE("Failed saving aiding data %s: %s", GPS_AIDING_FILE, strerror(errno));
+		return;
+	}
+	ok = write(fd, GPS_AIDING_MAGIC, strlen(GPS_AIDING_MAGIC)) == (ssize_t)strlen(GPS_AIDING_MAGIC) &&
+		write(fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec);
+	close(fd);
+	if (!ok || rename(GPS_AIDING_FILE ".tmp", GPS_AIDING_FILE) != 0) {
+		LOGE("Failed saving aiding data %s", GPS_AIDING_FILE);
+		unlink(GPS_AIDING_FILE ".tmp");
 	}
-	endGGA:	
-	free(info);
-	free(NMEA2);
-	free(arg);
 }
-static void updateGSV(void* arg) {
-	// This is NOT thread safe, block until it's our turn.
-	pthread_mutex_lock(&mutGSV);
-	argsCarrier *Args = (argsCarrier*)arg;
-	nmeaINFO *info = Args->info;
-	char* NMEA2 = Args->NMEA;
-	nmeaSATINFO sats = info->satinfo;
-	int num = sats.inview;
-	int count = 0;
-	GpsSvStatus *svStatus = NULL;
-	int numMessages = NMEA2[7] - 48;
-	int msgNumber = NMEA2[9] - 48;
-
-	//LOGV("Updating %i sats: msg %i/%i", num, numMessages, msgNumber);
-	
-	switch (msgNumber) {
-	
-	case (1):
-		if (svMask & MASK_GSV_MSG1) {
-		// We already have a message one.. dump the old, run with the new.
-		free(storeSV);
-		storeSV = NULL;
-		svMask = 0;
-		} 
-		svMask |= MASK_GSV_MSG1;
+
+// Reader side: the next free slot, or NULL if the callback thread is
+// a full queue behind.
+static nmeaSlot* acquireSlot() {
+	while (slotHead - slotTail >= NMEA_SLOTS) {
+		// A fast replay has no receiver to keep up with, wait for the
+		// callback thread so replays are lossless and repeatable
+		if (!(replayRunning && replayFast)) {
+			slotOverruns++;
+			return NULL;
+		}
+		sched_yield();
+	}
+	return &nmeaSlots[slotHead & (NMEA_SLOTS - 1)];
+}
+
+// Reader side: hand the slot from acquireSlot() to the callback thread.
+static void publishSlot() {
+	__sync_synchronize();
+	slotHead++;
+	gpsHistogramAdd(&histDepth, slotHead - slotTail);
+	sem_post(&slotReady);
+}
+
+// The sentence a binary message stands for, so nmea_cb gets NMEA
+// whatever the receiver speaks.
+static void makeSentence(nmeaSlot *slot) {
+	static const char hex[] = "0123456789ABCDEF";
+	nmeaGPGSV gsv;
+	char *star;
+	int crc;
+
+	switch (slot->type) {
+	case GPGGA:
+		slot->len = nmea_gen_GPGGA(slot->NMEA, sizeof(slot->NMEA), &slot->pack.gga);
 		break;
-	case (2):
-		if (svMask & MASK_GSV_MSG2) {
-		// We already have a message two.. dump the old, run with the new.
-		free(storeSV);
-		storeSV = NULL;
-		svMask = 0;
-		} 
-		svMask |= MASK_GSV_MSG2;
+	case GPGSA:
+		slot->len = nmea_gen_GPGSA(slot->NMEA, sizeof(slot->NMEA), &slot->pack.gsa);
 		break;
-	case (3):
-		if (svMask & MASK_GSV_MSG3) {
-		// We already have a message three.. dump the old, run with the new.
-		free(storeSV);
-		storeSV = NULL;
-		svMask = 0;
-		} 
-		svMask |= MASK_GSV_MSG3;
+	case GPGSV:
+		// The generator numbers the messages from 0
+		gsv = slot->pack.gsv;
+		gsv.pack_index--;
+		slot->len = nmea_gen_GPGSV(slot->NMEA, sizeof(slot->NMEA), &gsv);
 		break;
-	default:
-		// We should never be here..
+	case GPRMC:
+		slot->len = nmea_gen_GPRMC(slot->NMEA, sizeof(slot->NMEA), &slot->pack.rmc);
 		break;
+	default:
+		return;
 	}
-	
 
-	// Retrieve stored messages
-	if (storeSV == NULL) {
-		//  No Msgs stored, allocate new memory
-		svStatus = malloc(sizeof(GpsSvStatus));
-	} else {
-		svStatus = storeSV;
+	// The generator only knows GP, other systems get their own talker
+	if (slot->talker == NMEA_TALKER_GL || slot->talker == NMEA_TALKER_GA) {
+		slot->NMEA[1] = 'G';
+		slot->NMEA[2] = (slot->talker == NMEA_TALKER_GL) ? 'L' : 'A';
+		star = memchr(slot->NMEA, '*', slot->len);
+		if (star != NULL && star + 2 < slot->NMEA + slot->len) {
+			crc = nmea_calc_crc(slot->NMEA + 1, star - slot->NMEA - 1);
+			star[1] = hex[crc >> 4];
+			star[2] = hex[crc & 0xF];
+		}
 	}
+}
 
-	for (count = (msgNumber-1)*4; ((count < num) && (count < 4*msgNumber)); count++) {
-		svStatus->sv_list[count].size = sizeof(GpsSvInfo);
-		svStatus->sv_list[count].prn = sats.sat[count].id;
-		svStatus->sv_list[count].snr = sats.sat[count].sig;
-		svStatus->sv_list[count].elevation = sats.sat[count].elv;
-		svStatus->sv_list[count].azimuth = sats.sat[count].azimuth;
-		//LOGV("ID: %i; SIG: %i; ELE: %i; AZI: %i", sats.sat[count].id, sats.sat[count].sig, sats.sat[count].elv, sats.sat[count].azimuth);
+static void updateNMEA(nmeaSlot *slot) {
+	//LOGV("Debug GPS: %s", slot->NMEA);
+	if (adamGpsCallbacks != NULL && (subscription & SUB_NMEA)) {
+		if (slot->len == 0)
+			makeSentence(slot);
+		adamGpsCallbacks->nmea_cb(slot->time, slot->NMEA, slot->len);
 	}
+}
 
-	
-	switch (numMessages) {
-	case 1:
-		// Only one msg, and we're it
-		goto deliverMsg;
-		break;
-	case 2:
-		if (svMask == (MASK_GSV_MSG1 | MASK_GSV_MSG2)) {
-			// We've got both messages
-			//LOGV("Delivering 2: %i, %i", svMask, (MASK_GSV_MSG1 | MASK_GSV_MSG2));
-			goto deliverMsg;
-		} else {
-			//LOGV("Debug 2: %i, %i", svMask, (MASK_GSV_MSG1 | MASK_GSV_MSG2));
-			// Store for next run
-			storeSV = svStatus;
-			goto gsvEnd;
-		}
-		break;
-	case 3:
-		if (svMask == ((MASK_GSV_MSG1 | MASK_GSV_MSG2) | MASK_GSV_MSG3)) {
-			//LOGV("Delivering 3: %i, %i", svMask, ((MASK_GSV_MSG1 | MASK_GSV_MSG2) | MASK_GSV_MSG3));
-			goto deliverMsg;
-		} else {
-			//LOGV("Debug 2: %i, %i",svMask, ((MASK_GSV_MSG1 | MASK_GSV_MSG2) | MASK_GSV_MSG3));
-			storeSV = svStatus;
-			goto gsvEnd;
-		}
-		break;
-	default:
-		// Huh?
-		LOGE("Logic error in GSV! numMessages: %i", numMessages);
-		goto gsvEnd;
-	}
-		
+/////////////////////////////////////////////////////////
+//			EPOCH ASSEMBLER		       //
+/////////////////////////////////////////////////////////
+
+// GGA and RMC give the epoch its time. GSA, GSV and VTG carry none and
+// belong to whichever epoch is open when they arrive.
+static int sameTime(const nmeaTIME *a, const nmeaTIME *b) {
+	return a->hour == b->hour && a->min == b->min &&
+		a->sec == b->sec && a->hsec == b->hsec;
+}
+
+// The satellites of every system, GPS first, as far as GpsSvStatus
+// holds them. Its used mask only has room for GPS PRNs 1 - 32.
+static void fillSV(GpsSvStatus *svStatus) {
+	GpsSvInfo *info;
+	int sys, count;
 
-	///////////////////////////////////////////////////////
-	deliverMsg:
+	memset(svStatus, 0, sizeof(GpsSvStatus));
 	svStatus->size = sizeof(GpsSvStatus);
-	svStatus->num_svs = num; 
+	for (sys = 0; sys < NMEA_NSYS; sys++) {
+		for (count = 0; count < satTab.count && svStatus->num_svs < GPS_MAX_SVS; count++) {
+			if (satTab.sys[count] != sys)
+				continue;
+			info = &svStatus->sv_list[svStatus->num_svs++];
+			info->size = sizeof(GpsSvInfo);
+			info->prn = satTab.prn[count];
+			info->snr = satTab.sig[count];
+			info->elevation = satTab.elv[count];
+			info->azimuth = satTab.azimuth[count];
+		}
+	}
 	// TODO: Make these accurate
 	svStatus->ephemeris_mask = 0;
 	svStatus->almanac_mask = 0;
-	pthread_mutex_lock(&mutUseMask);
-	svStatus->used_in_fix_mask = useMask;
-	pthread_mutex_unlock(&mutUseMask);
-	if (adamGpsCallbacks != NULL) {
-		adamGpsCallbacks->sv_status_cb(svStatus);
+	svStatus->used_in_fix_mask = (uint32_t)satTab.used[NMEA_SYS_GPS];
+}
+
+// Reports follow the schedule once there is a fix, before that every
+// epoch's satellites are reported.
+static int reportEpoch() {
+	if (reportDone)
+		return 0;
+	if (schedInterval != 0 && !timeReached(reportDue))
+		return 0;
+	if (!epoch.fix)
+		return 1;
+
+	if (schedSingle) {
+		reportDone = 1;
+		readerResume = monotonicMS() + UINT32_MAX / 2;
+	} else if (schedInterval != 0) {
+		reportDue = monotonicMS() + schedInterval - SCHED_SLACK_MS;
+		// The filter needs the fixes in between, the reader keeps going
+		if (!filterOn)
+			readerResume = reportDue - SCHED_WARMUP_MS;
 	}
+	return 1;
+}
 
-	//LOGV("Pushing data");
-	free(svStatus);		
-	storeSV = NULL;
-	svMask = 0;
-	//////////////////////////////////////////////////////	
-	gsvEnd:
-	free(info);
-	free(NMEA2);
-	free(arg);
-	pthread_mutex_unlock(&mutGSV);
-}
-
-void processNMEA() {
-	argsCarrier *Args = malloc(sizeof(argsCarrier));
-	nmeaArgs *nArgs = malloc(sizeof(nmeaArgs));      
-	nmeaINFO *info = malloc(sizeof(nmeaINFO));
-        nmeaPARSER parser;
-        nmea_zero_INFO(info);
-        nmea_parser_init(&parser);
-	char *NMEA2;
-	nmeaINFO info2;
-	// Fix up the end so the NMEA parser accepts it
-	int count = (int)strlen(NMEA);
-	NMEA[count-1] = '\r';
-	NMEA[count] = '\n';
-	NMEA[count+1] = '\0';
-	// Parse the data
-	nmea_parse(&parser, NMEA, (int)strlen(NMEA), info);
+static void flushEpoch() {
+	if (epoch.fix && !ttffDone) {
+		ttffDone = 1;
+		reportTTFF();
+	}
+	// Every fix goes through the filter, reported or not, reportEpoch()
+	// keeps the reader going between reports while the filter is on
+	if (filterOn && epoch.fix)
+		gpsFilterUpdate(&filter, &epoch.loc, epoch.hdop);
+	if (epoch.fix && (epoch.loc.flags & GPS_LOCATION_HAS_LAT_LONG))
+		keepFix(&epoch.loc);
+	if (adamGpsCallbacks != NULL && (epoch.fix || (epoch.seen & GPGSV)) && reportEpoch()) {
+		if (epoch.fix && (subscription & SUB_LOCATION)) {
+			LOGV("Lat: %lf Long: %lf", epoch.loc.latitude, epoch.loc.longitude);
+			adamGpsCallbacks->location_cb(&epoch.loc);
+			gpsHistogramAdd(&histFix, monotonicUS() - epoch.readUS);
+		}
+		if ((epoch.seen & GPGSV) && (subscription & SUB_SV)) {
+			fillSV(&epochSV);
+			adamGpsCallbacks->sv_status_cb(&epochSV);
+		}
+	}
+	if (epoch.timed) {
+		lastEpochUTC = epoch.utc;
+		lastEpochValid = 1;
+	}
+	memset(&epoch, 0, sizeof(epoch));
+	epoch.loc.size = sizeof(GpsLocation);
+}
 
-	if (info->smask == 0) {
-		//Bad data
-		free(nArgs);
-		free(info);
-		free(Args);
+// Flush as soon as the epoch holds every sentence the receiver sent in
+// its last full epoch, instead of waiting for the next epoch to start.
+static void checkEpoch() {
+	int mask = epochMask;
+
+	// parseSlot() skips VTG once RMC is known, don't wait for it
+	if (mask & GPRMC)
+		mask &= ~GPVTG;
+	if (epoch.timed && mask != 0 && (epoch.seen & mask) == mask)
+		flushEpoch();
+}
+
+// Returns 0 if the sentence belongs to an epoch that was already reported.
+static int timeEpoch(const nmeaTIME *utc, const nmeaSlot *slot) {
+	if (epoch.timed && !sameTime(&epoch.utc, utc)) {
+		// A new epoch started, what we have is all the receiver sends
+		epochMask = epoch.seen;
+		flushEpoch();
+	} else if (!epoch.timed && lastEpochValid && sameTime(&lastEpochUTC, utc)) {
+		// Straggler of an epoch we flushed early, so the learned sentence
+		// set is too small. Learn it again from the next full epoch.
+		epochMask = 0;
+		return 0;
+	}
+
+	if (!epoch.timed) {
+		epoch.timed = 1;
+		epoch.utc = *utc;
+		epoch.loc.timestamp = slot->time;
+		epoch.readUS = slot->readUS;
+	}
+	return 1;
+}
+
+static void mergeGGA(nmeaSlot *slot) {
+	nmeaGPGGA *gga = &slot->pack.gga;
+
+	if (!timeEpoch(&gga->utc, slot))
+		return;
+	epoch.seen |= GPGGA;
+
+	if (gga->sig == 0) {
+		LOGV("No valid fix data.");
 		return;
 	}
-	// NOTE: Make copy of NMEA and Data for these threads - Don't want them to be overwritten by other threads
-	// Have the individual case function take care of freeing them
-	Args->NMEA = (char *)malloc((strlen(&NMEA[0])+1)*sizeof(char));
-	nArgs->NMEA = (char *)malloc((strlen(&NMEA[0])+1)*sizeof(char));
-	strcpy(Args->NMEA, NMEA);
-	strcpy(nArgs->NMEA, NMEA);
-	Args->info = info;
-	nArgs->time = getUTCTime(&(info->utc));
-	
-	adamGpsCallbacks->create_thread_cb("adamgps-nmea", updateNMEA, nArgs);
-	
-	switch (info->smask) {
-	case 1:
-		//< GGA - Essential fix data which provide 3D location and accuracy data.
-		adamGpsCallbacks->create_thread_cb("adamgps-gga", updateGGA, Args);
+
+	epoch.fix = 1;
+	epoch.loc.flags |= GPS_LOCATION_HAS_LAT_LONG | GPS_LOCATION_HAS_ALTITUDE | GPS_LOCATION_HAS_ACCURACY;
+	epoch.hdop = gga->HDOP;
+	epoch.loc.accuracy = (slot->accuracy > 0) ? slot->accuracy : nmea_dop2meters(gga->HDOP);
+	epoch.loc.altitude = gga->elv;
+	epoch.loc.latitude = gga->lat_nano / 1e9;
+	epoch.loc.longitude = gga->lon_nano / 1e9;
+}
+
+static void mergeRMC(nmeaSlot *slot) {
+	nmeaGPRMC *rmc = &slot->pack.rmc;
+
+	if (!timeEpoch(&rmc->utc, slot))
+		return;
+	epoch.seen |= GPRMC;
+	// The date of an RMC beats the one a GGA was stamped with
+	epoch.loc.timestamp = slot->time;
+
+	if (rmc->status != 'A') {
+		LOGV("No valid fix data.");
+		return;
+	}
+
+	epoch.fix = 1;
+	if (!(epoch.loc.flags & GPS_LOCATION_HAS_LAT_LONG)) {
+		// GGA has the same position and more, only use ours without it
+		epoch.loc.flags |= GPS_LOCATION_HAS_LAT_LONG;
+		epoch.loc.latitude = rmc->lat_nano / 1e9;
+		epoch.loc.longitude = rmc->lon_nano / 1e9;
+	}
+	epoch.loc.flags |= GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING;
+	epoch.loc.speed = rmc->speed * NMEA_TUD_KNOTS / NMEA_TUS_MS;
+	epoch.loc.bearing = rmc->direction;
+}
+
+static void mergeVTG(nmeaSlot *slot) {
+	nmeaGPVTG *vtg = &slot->pack.vtg;
+
+	epoch.seen |= GPVTG;
+	if (!(epoch.loc.flags & GPS_LOCATION_HAS_SPEED)) {
+		epoch.loc.flags |= GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING;
+		epoch.loc.speed = vtg->spk / NMEA_TUS_MS;
+		epoch.loc.bearing = vtg->dir;
+	}
+}
+
+static void mergeGSA(nmeaSlot *slot) {
+	// The first GSA of an epoch starts a new round, GN receivers send
+	// one per system
+	if (!(epoch.seen & GPGSA))
+		nmea_sattab_clear_used(&satTab);
+	epoch.seen |= GPGSA;
+	nmea_sattab_GSA(&satTab, slot->talker, &slot->pack.gsa);
+}
+
+// Reassembles the GSV messages of each talker into satTab. The epoch
+// sees GSV once the set of any talker is complete, and every system
+// that set reported, a GN set may report several.
+static void mergeGSV(nmeaSlot *slot) {
+	nmeaGPGSV *gsv = &slot->pack.gsv;
+	int systems, sys;
+
+	//LOGV("Updating %i sats: msg %i/%i", gsv->sat_count, gsv->pack_index, gsv->pack_count);
+	systems = nmea_sattab_GSV(&satTab, slot->talker, gsv);
+	for (sys = 0; sys < NMEA_NSYS; sys++)
+		if (systems & (1 << sys))
+			epoch.seen |= GPGSV | EPOCH_GSV(sys);
+}
+
+// Callback thread: delivers the queued sentences in the order they were read.
+static void dispatchNMEA(void* arg) {
+	nmeaSlot *slot;
+	uint32_t now;
+
+	for (;;) {
+		while (sem_wait(&slotReady) != 0)
+			;
+		if (slotTail == slotHead) {
+			// Woken without a sentence, the reader is done
+			if (dispatchQuit) {
+				flushEpoch();
+				break;
+			}
+			continue;
+		}
+		__sync_synchronize();
+		slot = &nmeaSlots[slotTail & (NMEA_SLOTS - 1)];
+
+		updateNMEA(slot);
+		switch (slot->type) {
+		case GPGGA:
+			//< GGA - Essential fix data which provide 3D location and accuracy data.
+			mergeGGA(slot);
+			break;
+		case GPGSA:
+			//< GSA - GPS receiver operating mode, SVs used for navigation, and DOP values.
+			mergeGSA(slot);
+			break;
+		case GPGSV:
+			//< GSV - Number of SVs in view, PRN numbers, elevation, azimuth & SNR values.
+			mergeGSV(slot);
+			break;
+		case GPRMC:
+			//< RMC - Recommended Minimum Specific GPS/TRANSIT Data.
+			mergeRMC(slot);
+			break;
+		case GPVTG:
+			//< VTG - Actual track made good and speed over ground.
+			mergeVTG(slot);
+			break;
+		default:
+			break;
+		}
+		checkEpoch();
+		now = monotonicUS();
+		gpsHistogramAdd(&histQueue, now - slot->parsedUS);
+		gpsHistogramAdd(&histTotal, now - slot->readUS);
+
+		__sync_synchronize();
+		slotTail++;
+	}
+	sem_post(&dispatchDone);
+}
+
+// Works out what the callbacks need. GGA and RMC carry the time of the
+// epochs and of the raw sentences, so they are parsed for everyone.
+static void subscribe() {
+	subscription = 0;
+	if (adamGpsCallbacks->nmea_cb != NULL)
+		subscription |= SUB_NMEA;
+	if (adamGpsCallbacks->location_cb != NULL)
+		subscription |= SUB_LOCATION;
+	if (adamGpsCallbacks->sv_status_cb != NULL)
+		subscription |= SUB_SV;
+
+	parseMask = GPGGA | GPRMC;
+	if (subscription & SUB_LOCATION)
+		parseMask |= GPVTG;
+	if (subscription & SUB_SV)
+		parseMask |= GPGSA | GPGSV;
+}
+
+// Checks the sentence in the slot and parses it into its packet if a
+// subscriber needs that type, otherwise its type is left GPNON.
+// Returns 0 if the sentence is bad or nobody wants it.
+static int parseSlot(nmeaSlot *slot) {
+	int crc = -1;
+	int ok = 0;
+	int wanted = parseMask;
+
+	if (nmea_find_tail(slot->NMEA, slot->len, &crc) != slot->len || crc < 0) {
+		checksumFails++;
+		return 0;
+	}
+
+	// VTG only adds speed to epochs without RMC. The mask belongs to the
+	// callback thread, a stale read only costs a parse.
+	if (epochMask & GPRMC)
+		wanted &= ~GPVTG;
+
+	slot->type = nmea_pack_type(slot->NMEA + 1, slot->len - 1);
+	slot->talker = nmea_pack_talker(slot->NMEA + 1, slot->len - 1);
+	if (!(slot->type & wanted))
+		slot->type = GPNON;
+	switch (slot->type) {
+	case GPGGA:
+		ok = nmea_parse_GPGGA(slot->NMEA, slot->len, &slot->pack.gga);
+		if (ok)
+			setTimeOfDay(&slot->pack.gga.utc);
 		break;
-	case 2: 
-		//< GSA - GPS receiver operating mode, SVs used for navigation, and DOP values.
-		adamGpsCallbacks->create_thread_cb("adamgps-gsa", updateGSA, Args);
+	case GPGSA:
+		ok = nmea_parse_GPGSA(slot->NMEA, slot->len, &slot->pack.gsa);
 		break;
-	case 4: 
-		//< GSV - Number of SVs in view, PRN numbers, elevation, azimuth & SNR values.
-		adamGpsCallbacks->create_thread_cb("adamgps-gsv", updateGSV, Args);
+	case GPGSV:
+		ok = nmea_parse_GPGSV(slot->NMEA, slot->len, &slot->pack.gsv);
 		break;
-	case 8: 
-		//< RMC - Recommended Minimum Specific GPS/TRANSIT Data.
-		//adamGpsCallbacks->create_thread_cb("adamgps-loc", updateRMC, Args);
-		free(Args->info);
-		free(Args->NMEA);
-		free(Args);			
+	case GPRMC:
+		ok = nmea_parse_GPRMC(slot->NMEA, slot->len, &slot->pack.rmc);
+		if (ok)
+			setDateTime(&slot->pack.rmc.utc);
 		break;
-	case 16:
-		//< VTG - Actual track made good and speed over ground.
-		free(Args->info);
-		free(Args->NMEA);
-		free(Args);
+	case GPVTG:
+		ok = nmea_parse_GPVTG(slot->NMEA, slot->len, &slot->pack.vtg);
 		break;
 	default:
-		free(Args->info);
-		free(Args->NMEA);
-		free(Args);
 		break;
 	}
 
-	//LOGV("Successful read: %i", info->smask);	
+	if (!ok && slot->type != GPNON) {
+		parseFails++;
+		slot->type = GPNON;
+	}
+	// Raw sentences are passed on whether or not they were parsed
+	return ok || (subscription & SUB_NMEA);
+}
+
+// Takes one line from the read buffer, starting at the '$'
+void processNMEA(const char *line, int count) {
+	nmeaSlot *slot;
+	uint32_t framedUS = monotonicUS();
+
+	// Strip the line ending the tty gave us
+	while (count > 0 && (line[count-1] == '\r' || line[count-1] == '\n'))
+		count--;
+	if (count == 0)
+		return;
+	// Maximum NMEA sentence SHOULD be 80 characters
+	if (count >= MAX_NMEA_CHARS) {
+		LOGV("Overlong sentence dropped");
+		partialDrops++;
+		return;
+	}
+
+	slot = acquireSlot();
+	if (slot == NULL) {
+		LOGV("All sentence slots busy, dropping: %.*s", count, line);
+		return;
+	}
+
+	// Fix up the end so the NMEA parser accepts it
+	memcpy(slot->NMEA, line, count);
+	slot->NMEA[count] = '\r';
+	slot->NMEA[count+1] = '\n';
+	slot->NMEA[count+2] = '\0';
+	slot->len = count + 2;
+	slot->accuracy = 0;
+
+	// Parse the data
+	if (!parseSlot(slot)) {
+		//Bad data
+		return;
+	}
+	nmeaSentences++;
+	slot->time = getUTCTime(&sessionUTC);
+	slot->readUS = lastReadUS;
+	slot->parsedUS = monotonicUS();
+	gpsHistogramAdd(&histFrame, framedUS - lastReadUS);
+	gpsHistogramAdd(&histParse, slot->parsedUS - framedUS);
+
+	publishSlot();
+	//LOGV("Successful read: %i", slot->type);	
+}
+
+
+// Raw 8N1 input, the receiver's baud rate is left as configured
+static void rawTTY(int fd) {
+	struct termios tio;
+
+	if (tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cc[VMIN] = 1;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &tio);
+		tcflush(fd, TCIFLUSH);
+	}
+}
+
+static int openTTY() {
+	int fd = open(GPS_TTYPORT, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+		return -1;
+
+	rawTTY(fd);
+	return fd;
+}
+
+// Microseconds from a to b
+static int64_t diffUS(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(b->tv_sec - a->tv_sec) * 1000000 + (b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+static void writeCapture(const char *buf, int len) {
+	struct iovec iov[2];
+	captureRecord rec;
+	struct timespec now;
+	int64_t delay;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	delay = diffUS(&captureLast, &now);
+	captureLast = now;
+	rec.delay = (delay > UINT32_MAX) ? UINT32_MAX : (uint32_t)delay;
+	rec.len = len;
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+	if (writev(captureFD, iov, 2) != (ssize_t)(sizeof(rec) + len)) {
+		LOGE("Capture write failed: %s", strerror(errno));
+		close(captureFD);
+		captureFD = -1;
+	}
+}
+
+// With debug.gps.capture set to 1, every read of the session is appended
+// to GPS_CAPTURE_FILE with its time, for replay through debug.gps.replay.
+static void openCapture() {
+	char value[PROPERTY_VALUE_MAX];
+
+	property_get("debug.gps.capture", value, "0");
+	if (strcmp(value, "1") != 0)
+		return;
+
+	mkdir(GPS_CAPTURE_DIR, 0770);
+	captureFD = open(GPS_CAPTURE_FILE, O_WRONLY | O_CREAT | O_APPEND, 0660);
+	if (captureFD < 0) {
+		LOGE("Failed opening capture file %s: %s", GPS_CAPTURE_FILE, strerror(errno));
+		return;
+	}
+	if (lseek(captureFD, 0, SEEK_END) == 0)
+		write(captureFD, GPS_CAPTURE_MAGIC, strlen(GPS_CAPTURE_MAGIC));
+
+	// Session start, the delay of the first read counts from here
+	clock_gettime(CLOCK_MONOTONIC, &captureLast);
+	writeCapture(NULL, 0);
 }
 
+static void closeCapture() {
+	if (captureFD >= 0) {
+		close(captureFD);
+		captureFD = -1;
+	}
+}
+
+// Writes len bytes to the pty, returns 0 if the session stopped first
+static int replayWrite(const char *buf, int len) {
+	struct pollfd fds[2];
+	ssize_t put;
+
+	fds[0].fd = replayPty;
+	fds[0].events = POLLOUT;
+	fds[1].fd = wakePipe[0];
+	fds[1].events = POLLIN;
+
+	while (len > 0) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		if (fds[1].revents)
+			return 0;
+		put = write(replayPty, buf, len);
+		if (put < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return 0;
+		}
+		buf += put;
+		len -= put;
+	}
+	return 1;
+}
+
+// Replay thread: writes the reads of the capture file to the pty with
+// their recorded delays, or back to back with debug.gps.replay_mode "fast".
+static void* replayNMEA(void* arg) {
+	static char buffer[TTY_READ_CHARS];
+	struct pollfd wake;
+	struct timespec start, now;
+	captureRecord rec;
+	int64_t due = 0, wait;
+	uint32_t bytes = 0;
+
+	wake.fd = wakePipe[0];
+	wake.events = POLLIN;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (fread(&rec, sizeof(rec), 1, replayFile) == 1) {
+		if (rec.len > sizeof(buffer) || fread(buffer, 1, rec.len, replayFile) != rec.len) {
+			LOGE("Capture file is truncated or corrupt");
+			break;
+		}
+		// A new session of the capture, the time between sessions is skipped
+		if (rec.len == 0)
+			continue;
+
+		if (!replayFast) {
+			// Sleep to the record's time from the start, so delays don't add up
+			due += rec.delay;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			wait = (due - diffUS(&start, &now)) / 1000;
+			if (wait > 0 && poll(&wake, 1, (int)wait) > 0)
+				break;
+		}
+		if (!replayWrite(buffer, rec.len))
+			break;
+		bytes += rec.len;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	LOGI("Replay: %u bytes in %lld ms", bytes, (long long)(diffUS(&start, &now) / 1000));
+	fclose(replayFile);
+	replayFile = NULL;
+	// The pty stays open until stopReplay(), a hangup would drop what
+	// the reader has not read yet
+	return NULL;
+}
+
+// Opens a pty fed from the capture file by the replay thread, and
+// returns its slave end for the reader in place of the tty.
+static int openReplay(const char *path) {
+	char magic[sizeof(GPS_CAPTURE_MAGIC) - 1];
+	int fd;
+
+	replayFile = fopen(path, "rb");
+	if (replayFile == NULL) {
+		LOGE("Failed opening capture file %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (fread(magic, sizeof(magic), 1, replayFile) != 1 ||
+		memcmp(magic, GPS_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+		LOGE("%s is not a capture file", path);
+		goto failFile;
+	}
+
+	replayPty = open("/dev/ptmx", O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (replayPty < 0 || unlockpt(replayPty) != 0) {
+		LOGE("Failed opening a pty: %s", strerror(errno));
+		goto failPty;
+	}
+	fd = open(ptsname(replayPty), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		LOGE("Failed opening the pty slave: %s", strerror(errno));
+		goto failPty;
+	}
+	// No echo back to the master, nobody reads it
+	rawTTY(fd);
+
+	if (pthread_create(&replayThread, NULL, replayNMEA, NULL) != 0) {
+		close(fd);
+		goto failPty;
+	}
+	replayRunning = 1;
+	LOGI("Replaying %s%s", path, replayFast ? " as fast as possible" : "");
+	return fd;
+
+failPty:
+	if (replayPty >= 0)
+		close(replayPty);
+	replayPty = -1;
+failFile:
+	fclose(replayFile);
+	replayFile = NULL;
+	return -1;
+}
+
+static void stopReplay() {
+	if (replayRunning) {
+		// Wake the replay thread too, in case the reader quit on its own
+		write(wakePipe[1], "", 1);
+		pthread_join(replayThread, NULL);
+		replayRunning = 0;
+		close(replayPty);
+		replayPty = -1;
+	}
+}
+
+// Frames every complete line in buf and returns the bytes consumed
+static int frameNMEA(char *buf, int len) {
+	char *start = buf;
+	char *end = buf + len;
+	char *eol;
+
+	while ((eol = memchr(start, '\n', end - start)) != NULL) {
+		char *dollar = memchr(start, '$', eol - start);
+		if (dollar != NULL) {
+			//We have a good sentance
+			processNMEA(dollar, eol - dollar);
+		} else if (eol - start > 1) {
+			// The tail of a line whose start we missed
+			partialDrops++;
+		}
+		start = eol + 1;
+	}
+	return start - buf;
+}
+
+// Mode, fix type and DOP of the last NAV-PVT for the GSA of NAV-SAT, reader only
+static nmeaGPGSA ubxGSA;
+
+// Reader side: queues a packet a binary message stands for, like a
+// parsed sentence. Returns 0 if the queue is full.
+static int queuePack(int type, int talker, const void *pack, size_t size, float accuracy) {
+	nmeaSlot *slot;
+
+	// Nobody needs it, as parseSlot() decides for sentences
+	if (!(type & parseMask) && !(subscription & SUB_NMEA))
+		return 1;
+	slot = acquireSlot();
+	if (slot == NULL)
+		return 0;
+
+	slot->type = type;
+	slot->talker = talker;
+	slot->len = 0;
+	slot->accuracy = accuracy;
+	memcpy(&slot->pack, pack, size);
+	slot->time = getUTCTime(&sessionUTC);
+	slot->readUS = lastReadUS;
+	slot->parsedUS = monotonicUS();
+	publishSlot();
+	return 1;
+}
+
+// The GSA and GSV sets of one system of a NAV-SAT
+static int queueSatellites(int talker, const nmeaSATELLITE *sat, int count) {
+	nmeaGPGSA gsa = ubxGSA;
+	nmeaGPGSV gsv;
+	int it, used = 0, queued = 0;
+
+	// At least one GSA, twelve satellites to each
+	for (it = 0; it < count; it++) {
+		if (!sat[it].in_use)
+			continue;
+		gsa.sat_prn[used++] = sat[it].id;
+		if (used == NMEA_MAXSAT) {
+			if (!queuePack(GPGSA, talker, &gsa, sizeof(gsa), 0))
+				return 0;
+			memset(gsa.sat_prn, 0, sizeof(gsa.sat_prn));
+			used = 0;
+			queued++;
+		}
+	}
+	if ((used > 0 || queued == 0) && !queuePack(GPGSA, talker, &gsa, sizeof(gsa), 0))
+		return 0;
+
+	nmea_zero_GPGSV(&gsv);
+	gsv.sat_count = count;
+	gsv.pack_count = (count + NMEA_SATINPACK - 1) / NMEA_SATINPACK;
+	if (gsv.pack_count == 0)
+		gsv.pack_count = 1;
+	for (gsv.pack_index = 1; gsv.pack_index <= gsv.pack_count; gsv.pack_index++) {
+		memset(gsv.sat_data, 0, sizeof(gsv.sat_data));
+		for (it = 0; it < NMEA_SATINPACK && (gsv.pack_index - 1) * NMEA_SATINPACK + it < count; it++)
+			gsv.sat_data[it] = sat[(gsv.pack_index - 1) * NMEA_SATINPACK + it];
+		if (!queuePack(GPGSV, talker, &gsv, sizeof(gsv), 0))
+			return 0;
+	}
+	return 1;
+}
+
+// Takes one UBX frame. NAV-PVT becomes a GGA and an RMC, NAV-SAT the
+// GSA and GSV sets of each system, for the epoch assembler as usual.
+static void processUBX(const ubxFrame *frame) {
+	static const int talkers[NMEA_NSYS] = { NMEA_TALKER_GP, NMEA_TALKER_GL, NMEA_TALKER_GA };
+	static ubxSatellites sats;
+	uint32_t framedUS = monotonicUS();
+	nmeaGPGGA gga;
+	nmeaGPRMC rmc;
+	float accuracy;
+	int ok = 1, sys;
+
+	if (frame->cls != UBX_CLASS_NAV)
+		return;
+	switch (frame->id) {
+	case UBX_NAV_PVT:
+		if (!ubxParsePVT(frame, &gga, &rmc, &ubxGSA, &accuracy)) {
+			parseFails++;
+			return;
+		}
+		setDateTime(&rmc.utc);
+		ok = queuePack(GPGGA, NMEA_TALKER_GP, &gga, sizeof(gga), accuracy) &&
+			queuePack(GPRMC, NMEA_TALKER_GP, &rmc, sizeof(rmc), 0);
+		break;
+	case UBX_NAV_SAT:
+		if (!ubxParseSAT(frame, &sats)) {
+			parseFails++;
+			return;
+		}
+		// GPS even without satellites, as NMEA receivers send an empty GSV
+		for (sys = 0; sys < NMEA_NSYS && ok; sys++) {
+			if (sys == NMEA_SYS_GPS || sats.count[sys] > 0)
+				ok = queueSatellites(talkers[sys], sats.sat[sys], sats.count[sys]);
+		}
+		break;
+	default:
+		return;
+	}
+
+	// Dropped, acquireSlot() counted the overrun as it does for sentences
+	if (!ok) {
+		LOGV("All sentence slots busy, dropping UBX %02x %02x", frame->cls, frame->id);
+		return;
+	}
+	nmeaSentences++;
+	gpsHistogramAdd(&histFrame, framedUS - lastReadUS);
+	gpsHistogramAdd(&histParse, monotonicUS() - framedUS);
+}
+
+// Frames every complete UBX message in buf and the NMEA sentences in
+// between, receivers speaking UBX send both. Returns the bytes consumed.
+static int frameUBX(char *buf, int len) {
+	unsigned char *start = (unsigned char *)buf;
+	unsigned char *end = start + len;
+	char noise = 0;
+	ubxFrame frame;
+	char *eol;
+	int size, span;
+
+	while (start < end) {
+		if (*start == '$') {
+			// A '$' without a line end a sentence's length on is noise
+			span = (end - start < MAX_NMEA_CHARS + 2) ? end - start : MAX_NMEA_CHARS + 2;
+			eol = memchr(start, '\n', span);
+			if (eol != NULL) {
+				processNMEA((char *)start, eol - (char *)start);
+				start = (unsigned char *)eol + 1;
+				noise = 0;
+				continue;
+			}
+			if (span < MAX_NMEA_CHARS + 2)
+				break;
+		}
+		if (*start == UBX_SYNC1) {
+			size = ubxCheckFrame(start, end - start, &frame);
+			if (size == 0)
+				break;
+			if (size > 0) {
+				processUBX(&frame);
+				start += size;
+				noise = 0;
+				continue;
+			}
+			// Not a frame after all, look for the next one from the byte after
+			checksumFails++;
+		} else if (*start != '\r' && *start != '\n' && !noise) {
+			// Bytes of a message whose start we missed
+			partialDrops++;
+			noise = 1;
+		}
+		start++;
+	}
+	return (char *)start - buf;
+}
+
+// Receiver protocols, debug.gps.protocol picks one by name. frame() takes
+// the complete messages out of the read buffer into slots and returns the
+// bytes it consumed, the rest is kept for the next read.
+typedef struct _gpsProtocol
+{
+	const char	*name;
+	int		(*frame)(char *buf, int len);
+} gpsProtocol;
+
+static const gpsProtocol protocols[] = {
+	{ "nmea", frameNMEA },
+	{ "ubx", frameUBX },
+};
+
+static const gpsProtocol* findProtocol(const char *name) {
+	unsigned int it;
+
+	for (it = 0; it < sizeof(protocols) / sizeof(protocols[0]); it++) {
+		if (strcmp(protocols[it].name, name) == 0)
+			return &protocols[it];
+	}
+	LOGE("Unknown protocol %s, using %s", name, protocols[0].name);
+	return &protocols[0];
+}
 
 static void* doGPS (void* arg) {
-	FILE *gpsTTY = NULL;
-	char* buffer = NULL;
-
-        // Maximum NMEA sentence SHOULD be 80 characters  + terminators - include a small safety buffer 
-	struct timespec slp;
-	char go = 1;	
-	slp.tv_sec = 1;
-	slp.tv_nsec = 0;
-	// Open the GPS port
-	gpsTTY = fopen(GPS_TTYPORT, "r");
-	if (gpsTTY == NULL) {
-		LOGE("Failed opening TTY port: %s", GPS_TTYPORT);
-		return NULL;
-	}
-	// Obtain mutex lock and check if we're good to go
-	pthread_mutex_lock(&mutGPS);
-	go = gpsOn;
-	pthread_mutex_unlock(&mutGPS);
+	static char buffer[TTY_READ_CHARS];
+	char replay[PROPERTY_VALUE_MAX];
+	char mode[PROPERTY_VALUE_MAX];
+	char filterMode[PROPERTY_VALUE_MAX];
+	char protocolName[PROPERTY_VALUE_MAX];
+	const gpsProtocol *protocol;
+	struct pollfd fds[2];
+	GpsUtcTime utc;
+	int gpsTTY = -1;
+	int fill = 0;
+	int used;
+	int32_t idle;
+	ssize_t got;
+
+	// Open the GPS port, or a capture file replayed in its place
+	property_get("debug.gps.replay", replay, "");
+	if (replay[0] != '\0') {
+		property_get("debug.gps.replay_mode", mode, "realtime");
+		replayFast = (strcmp(mode, "fast") == 0);
+		gpsTTY = openReplay(replay);
+	} else {
+		gpsTTY = openTTY();
+	}
+	if (gpsTTY < 0) {
+		LOGE("Failed opening TTY port: %s", (replay[0] != '\0') ? replay : GPS_TTYPORT);
+		goto stopDispatch;
+	}
+	openCapture();
+
+	// Fresh session state, the slots are reused for the whole session
+	aidingOn = (replay[0] == '\0');
+	utc = startClock();
+	ttffDone = 0;
+	resetStats();
+	nmea_sattab_clear(&satTab);
+	memset(&epoch, 0, sizeof(epoch));
+	epoch.loc.size = sizeof(GpsLocation);
+	epochMask = 0;
+	lastEpochValid = 0;
+	property_get("debug.gps.protocol", protocolName, "nmea");
+	protocol = findProtocol(protocolName);
+	nmea_zero_GPGSA(&ubxGSA);
+	property_get("debug.gps.filter", filterMode, "0");
+	filterOn = (strcmp(filterMode, "1") == 0);
+	gpsFilterReset(&filter);
+	if (filterOn)
+		aidFilter(utc);
+
+	fds[0].fd = gpsTTY;
+	fds[0].events = POLLIN;
+	fds[1].fd = wakePipe[0];
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		// No report is due for a while, leave the tty alone until then
+		if (!timeReached(readerResume)) {
+			idle = (int32_t)(readerResume - monotonicMS());
+			if (idle > SCHED_MAX_SLEEP_MS)
+				idle = SCHED_MAX_SLEEP_MS;
+			if (idle > 0 && poll(&fds[1], 1, idle) > 0)
+				break;
+			if (timeReached(readerResume)) {
+				// What piled up meanwhile is stale
+				tcflush(gpsTTY, TCIFLUSH);
+				fill = 0;
+			}
+			continue;
+		}
 
-	while (go) {
-		buffer = fgets(NMEA, MAX_NMEA_CHARS, gpsTTY);
-		if (buffer == NULL) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("poll failed: %s", strerror(errno));
+			break;
+		}
+		// gpslib_stop() wrote to the wake pipe
+		if (fds[1].revents)
+			break;
+		if (!fds[0].revents)
+			continue;
+
+		got = read(gpsTTY, buffer + fill, sizeof(buffer) - fill);
+		if (got <= 0) {
+			if (got < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			// Port went away, retry in a second unless we are stopped first
 			LOGV("NMEA data read fail, sleeping for 1 sec.");
-			nanosleep(&slp, NULL);
+			if (poll(&fds[1], 1, 1000) > 0)
+				break;
+			continue;
+		}
+		lastReadUS = monotonicUS();
+		if (captureFD >= 0)
+			writeCapture(buffer + fill, got);
+		fill += got;
+
+		used = protocol->frame(buffer, fill);
+		if (used == 0 && fill == (int)sizeof(buffer)) {
+			// A buffer full of noise without a line end
+			used = fill;
+			partialDrops++;
+		}
+		if (used > 0) {
+			fill -= used;
+			memmove(buffer, buffer + used, fill);
 		}
-		if (NMEA[0] == '$') {
-			//We have a good sentance
-			processNMEA();
-			// Get rid of the extra LF
-			fgetc(gpsTTY);
-		} 
-		pthread_mutex_lock(&mutGPS);
-		go = gpsOn;
-		pthread_mutex_unlock(&mutGPS);
 	}
-fclose(gpsTTY);
+close(gpsTTY);
+closeCapture();
+stopReplay();
+
+stopDispatch:
+// Let the callback thread drain the queue before the next session reuses it
+dispatchQuit = 1;
+sem_post(&slotReady);
+while (sem_wait(&dispatchDone) != 0)
+	;
+publishCounters();
+dumpStats();
+if (aidingOn)
+	saveAiding();
 return NULL;
 }
 
@@ -436,8 +1599,8 @@ static int gpslib_init(GpsCallbacks* callbacks) {
 int ret = 0;
 LOGV("Callbacks set");
 adamGpsCallbacks = callbacks;
-adamGpsCallbacks->set_capabilities_cb(0);
-GpsStatus *status = malloc(sizeof(GpsStatus));
+adamGpsCallbacks->set_capabilities_cb(GPS_CAPABILITY_SCHEDULING | GPS_CAPABILITY_SINGLE_SHOT);
+GpsStatus *status = gpsAlloc(sizeof(GpsStatus));
 
 struct stat st;
 if(stat(GPS_TTYPORT, &st) != 0) {
@@ -447,6 +1610,15 @@ if(stat(GPS_TTYPORT, &st) != 0) {
 }
 
 
+if (satTab.capacity == 0 && !nmea_sattab_init(&satTab, SAT_TABLE_SIZE)) {
+	ret = -1;
+	LOGE("Failed allocating the satellite table");
+	goto end;
+}
+// Aiding from the last session, unless this process has its own already
+if (aiding.time == 0 && aiding.fixTime == 0)
+	loadAiding();
+
 status->size = sizeof(GpsStatus);
 status->status = GPS_STATUS_ENGINE_ON;
 adamGpsCallbacks->create_thread_cb("adamgps-status", updateStatus, status);
@@ -456,32 +1628,80 @@ return ret;
 }
 
 static int gpslib_start() {
+char wake;
 LOGV("Gps start");
-GpsStatus *stat = malloc(sizeof(GpsStatus));
+// A running session goes on as it is
+pthread_mutex_lock(&mutGPS);
+if (gpsOn) {
+	pthread_mutex_unlock(&mutGPS);
+	LOGV("GPS already started");
+	return 0;
+}
+pthread_mutex_unlock(&mutGPS);
+// Nothing is changed until the session can run
+if (wakePipe[0] < 0) {
+	if (pipe(wakePipe) != 0) {
+		LOGE("Failed creating wake pipe: %s", strerror(errno));
+		wakePipe[0] = wakePipe[1] = -1;
+		return -1;
+	}
+	fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakePipe[1], F_SETFL, O_NONBLOCK);
+}
+// A previous session must be fully wound down before its queue is reused
+if (readerRunning) {
+	pthread_join(NMEAThread, NULL);
+	readerRunning = 0;
+}
+// Drop a wake-up left over from the last stop
+while (read(wakePipe[0], &wake, 1) > 0)
+	;
+slotHead = slotTail = 0;
+dispatchQuit = 0;
+sessionStart = monotonicMS();
+subscribe();
+// The first fix of a session is reported right away
+reportDone = 0;
+reportDue = readerResume = monotonicMS();
+sem_init(&slotReady, 0, 0);
+sem_init(&dispatchDone, 0, 0);
+pthread_mutex_lock(&mutGPS);
+gpsOn = 1;
+heapAllocs = 0;
+pthread_mutex_unlock(&mutGPS);
+if (pthread_create(&NMEAThread, NULL, doGPS, NULL) != 0) {
+	LOGE("Failed creating the reader thread");
+	pthread_mutex_lock(&mutGPS);
+	gpsOn = 0;
+	pthread_mutex_unlock(&mutGPS);
+	return -1;
+}
+readerRunning = 1;
+adamGpsCallbacks->create_thread_cb("adamgps-cb", dispatchNMEA, NULL);
+GpsStatus *stat = gpsAlloc(sizeof(GpsStatus));
 stat->size = sizeof(GpsStatus);
 stat->status = GPS_STATUS_SESSION_BEGIN;
 adamGpsCallbacks->create_thread_cb("adamgps-status", updateStatus, stat);
-pthread_mutex_lock(&mutGPS);
-gpsOn = 1;
-pthread_mutex_unlock(&mutGPS);	
-pthread_create(&NMEAThread, NULL, doGPS, NULL);
 return 0;
 }
 
 static int gpslib_stop() {
 LOGV("GPS stop");
-GpsStatus *stat = malloc(sizeof(GpsStatus));
-stat->size = sizeof(GpsStatus);
-stat->status = GPS_STATUS_SESSION_END;
-adamGpsCallbacks->create_thread_cb("adamgps-status", updateStatus, stat);
 pthread_mutex_lock(&mutGPS);
 gpsOn = 0;
 pthread_mutex_unlock(&mutGPS);
+// Kick the reader out of poll()
+if (wakePipe[1] >= 0)
+	write(wakePipe[1], "", 1);
+GpsStatus *stat = gpsAlloc(sizeof(GpsStatus));
+stat->size = sizeof(GpsStatus);
+stat->status = GPS_STATUS_SESSION_END;
+adamGpsCallbacks->create_thread_cb("adamgps-status", updateStatus, stat);
 return 0;
 }
 
 static void gpslib_cleanup() {
-GpsStatus *stat = malloc(sizeof(GpsStatus));
+GpsStatus *stat = gpsAlloc(sizeof(GpsStatus));
 stat->size = sizeof(GpsStatus);
 stat->status = GPS_STATUS_ENGINE_OFF;
 adamGpsCallbacks->create_thread_cb("adamgps-status", updateStatus, stat);
@@ -489,25 +1709,64 @@ LOGV("GPS clean");
 return;
 }
 
+// The receiver takes no aiding over the tty, so the injections only seed
+// the session clock and the filter of the next start (see startClock).
+// An injected position is no fix, it is not saved and does not make the
+// next start warm.
 static int gpslib_inject_time(GpsUtcTime time, int64_t timeReference,
                          int uncertainty) {
-LOGV("GPS inject time");
+LOGV("GPS inject time %lld +- %d ms", (long long)time, uncertainty);
+// Injected right after the NTP reply, so taken as the time of now
+pthread_mutex_lock(&mutGPS);
+aiding.time = time;
+aiding.timeAt = monotonicMS();
+aiding.timeLive = 1;
+pthread_mutex_unlock(&mutGPS);
 return 0;
 }
 
 static int gpslib_inject_location(double latitude, double longitude, float accuracy) {
-LOGV("GPS inject location");
+GpsUtcTime now;
+LOGV("GPS inject location %f %f +- %f m", latitude, longitude, accuracy);
+pthread_mutex_lock(&mutGPS);
+now = aidingNow();
+aiding.injectTime = (now != 0) ? now : systemUTC();
+aiding.injectLatitude = latitude;
+aiding.injectLongitude = longitude;
+aiding.injectAccuracy = accuracy;
+pthread_mutex_unlock(&mutGPS);
 return 0;
 }
 
 
+// Only forgets what the HAL keeps, the receiver keeps its own
 static void gpslib_delete_aiding_data(GpsAidingData flags) {
-
+char running;
+LOGV("GPS delete aiding data %x", flags);
+pthread_mutex_lock(&mutGPS);
+if (flags & GPS_DELETE_POSITION)
+	aiding.fixTime = aiding.injectTime = 0;
+if (flags & GPS_DELETE_TIME) {
+	aiding.time = 0;
+	aiding.timeLive = 0;
+}
+running = gpsOn;
+pthread_mutex_unlock(&mutGPS);
+// A running session saves on its end
+if (!running)
+	saveAiding();
 }
 
 static int gpslib_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence,
             uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time) {
-
+LOGV("Position mode %u, recurrence %u, interval %u ms", mode, recurrence, min_interval);
+// Standalone only, there is no assistance data for the MS modes. The
+// receiver runs at its own rate, the reports are thinned to min_interval.
+schedSingle = (recurrence == GPS_POSITION_RECURRENCE_SINGLE);
+schedInterval = min_interval;
+// Takes effect with the next fix
+reportDone = 0;
+reportDue = readerResume = monotonicMS();
 return 0;
 }
 
@@ -0,0 +1,71 @@
+// NI Adam GPS library
+// Latency histograms of the sentence path
+
+#include <string.h>
+#include "gpsstats.h"
+
+static int bucketOf(uint32_t value) {
+	int bucket;
+
+	if (value == 0)
+		return 0;
+	bucket = 32 - __builtin_clz(value);
+	return (bucket < STATS_BUCKETS) ? bucket : STATS_BUCKETS - 1;
+}
+
+// Largest value of a bucket
+static uint32_t bucketTop(int bucket) {
+	if (bucket == 0)
+		return 0;
+	return (uint32_t)((1ULL << bucket) - 1);
+}
+
+void gpsHistogramReset(gpsHistogram *hist) {
+	memset(hist->count, 0, sizeof(hist->count));
+	hist->max = 0;
+}
+
+void gpsHistogramAdd(gpsHistogram *hist, uint32_t value) {
+	hist->count[bucketOf(value)]++;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+// Upper bound of the percentile, the top of the bucket it falls in
+uint32_t gpsHistogramPercentile(const gpsHistogram *hist, int percent) {
+	uint64_t total = 0, seen = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < STATS_BUCKETS; bucket++)
+		total += hist->count[bucket];
+	if (total == 0)
+		return 0;
+	for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+		seen += hist->count[bucket];
+		if (seen * 100 >= total * percent)
+			break;
+	}
+	if (bucket == STATS_BUCKETS - 1 || bucketTop(bucket) > hist->max)
+		return hist->max;
+	return bucketTop(bucket);
+}
+
+// One line with the summary, then one per bucket that counted anything
+void gpsHistogramDump(FILE *out, const gpsHistogram *hist) {
+	uint32_t total = 0;
+	int bucket;
+
+	for (bucket = 0; bucket < STATS_BUCKETS; bucket++)
+		total += hist->count[bucket];
+	fprintf(out, "%s: count %u p50 %u p90 %u p99 %u max %u\n", hist->name, total,
+		gpsHistogramPercentile(hist, 50), gpsHistogramPercentile(hist, 90),
+		gpsHistogramPercentile(hist, 99), hist->max);
+	for (bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+		if (hist->count[bucket] == 0)
+			continue;
+		if (bucket == STATS_BUCKETS - 1)
+			fprintf(out, "  >=%u %u\n", bucketTop(bucket - 1) + 1, hist->count[bucket]);
+		else
+			fprintf(out, "  <=%u %u\n", bucketTop(bucket), hist->count[bucket]);
+	}
+}
@@ -0,0 +1,28 @@
+// NI Adam GPS library
+// Latency histograms of the sentence path
+
+#ifndef GPSSTATS_H
+#define GPSSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bucket 0 counts the value 0, bucket i the values 2^(i-1) to 2^i - 1,
+// the last one everything larger
+#define STATS_BUCKETS 24
+
+// Every histogram has a single writer thread, the others only read it.
+// Adding a value is a few instructions and takes no lock.
+typedef struct _gpsHistogram
+{
+	const char	*name;
+	uint32_t	count[STATS_BUCKETS];
+	uint32_t	max;
+} gpsHistogram;
+
+void gpsHistogramReset(gpsHistogram *hist);
+void gpsHistogramAdd(gpsHistogram *hist, uint32_t value);
+uint32_t gpsHistogramPercentile(const gpsHistogram *hist, int percent);
+void gpsHistogramDump(FILE *out, const gpsHistogram *hist);
+
+#endif
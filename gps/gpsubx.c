@@ -0,0 +1,220 @@
+// NI Adam GPS library
+// u-blox UBX binary protocol: frames and the navigation messages
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "gpsubx.h"
+
+// NAV-PVT fields
+#define PVT_VALID_DATE 0x01
+#define PVT_FIX_OK 0x01
+#define PVT_DIFF_SOLN 0x02
+// NAV-SAT flags
+#define SAT_USED 0x08
+
+// UBX is little endian
+static unsigned int getU2(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static int getI2(const unsigned char *p) {
+	return (int16_t)getU2(p);
+}
+
+static uint32_t getU4(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int32_t getI4(const unsigned char *p) {
+	return (int32_t)getU4(p);
+}
+
+// 8 bit Fletcher over class, id, length and payload
+static void checksum(const unsigned char *buf, int len, unsigned char *ckA, unsigned char *ckB) {
+	unsigned char a = 0, b = 0;
+
+	while (len-- > 0) {
+		a += *buf++;
+		b += a;
+	}
+	*ckA = a;
+	*ckB = b;
+}
+
+// Checks the frame at the start of buf, which starts with the sync chars.
+// Returns the length of the frame, 0 if buf holds only a part of it, or
+// -1 if it is no frame: bad sync, overlong or a bad checksum.
+int ubxCheckFrame(const unsigned char *buf, int len, ubxFrame *frame) {
+	unsigned char ckA, ckB;
+	int payload;
+
+	if (len >= 1 && buf[0] != UBX_SYNC1)
+		return -1;
+	if (len >= 2 && buf[1] != UBX_SYNC2)
+		return -1;
+	if (len < UBX_HEADER)
+		return 0;
+	payload = getU2(buf + 4);
+	if (payload > UBX_MAX_PAYLOAD)
+		return -1;
+	if (len < payload + UBX_OVERHEAD)
+		return 0;
+
+	checksum(buf + 2, payload + 4, &ckA, &ckB);
+	if (buf[UBX_HEADER + payload] != ckA || buf[UBX_HEADER + payload + 1] != ckB)
+		return -1;
+
+	frame->cls = buf[2];
+	frame->id = buf[3];
+	frame->len = payload;
+	frame->payload = buf + UBX_HEADER;
+	return payload + UBX_OVERHEAD;
+}
+
+// Frames a message into buf, returns its length or 0 if it won't fit
+int ubxWriteFrame(unsigned char *buf, int size, int cls, int id,
+	const unsigned char *payload, int len) {
+	if (len > UBX_MAX_PAYLOAD || size < len + UBX_OVERHEAD)
+		return 0;
+
+	buf[0] = UBX_SYNC1;
+	buf[1] = UBX_SYNC2;
+	buf[2] = cls;
+	buf[3] = id;
+	buf[4] = len & 0xFF;
+	buf[5] = len >> 8;
+	memcpy(buf + UBX_HEADER, payload, len);
+	checksum(buf + 2, len + 4, &buf[UBX_HEADER + len], &buf[UBX_HEADER + len + 1]);
+	return len + UBX_OVERHEAD;
+}
+
+// Degrees * 1e7 -> NDEG for the sentences, its hemisphere and the exact
+// nano-degrees
+static double toNDEG(int32_t value, char *hemisphere, char positive, char negative,
+	long long *nano) {
+	*hemisphere = (value < 0) ? negative : positive;
+	*nano = value * 100LL;
+	return nmea_degree2ndeg(fabs(value * 1e-7));
+}
+
+// Splits a NAV-PVT into the GGA and RMC a receiver would have sent, at
+// full precision, and the mode of its GSA without the satellites, those
+// are in NAV-SAT. accuracy is the receiver's horizontal estimate in meters.
+// The DOP of the GGA is the position DOP, NAV-PVT has no horizontal one.
+// Returns 0 if the frame is no NAV-PVT.
+int ubxParsePVT(const ubxFrame *frame, nmeaGPGGA *gga, nmeaGPRMC *rmc,
+	nmeaGPGSA *gsa, float *accuracy) {
+	const unsigned char *p = frame->payload;
+	int fixType, flags, fix, hsec;
+	nmeaTIME utc;
+
+	if (frame->cls != UBX_CLASS_NAV || frame->id != UBX_NAV_PVT || frame->len < UBX_NAV_PVT_LEN)
+		return 0;
+
+	memset(&utc, 0, sizeof(utc));
+	utc.hour = p[8];
+	utc.min = p[9];
+	utc.sec = p[10];
+	// The nanoseconds may be slightly negative, the time is rounded
+	hsec = (getI4(p + 16) + 5000000) / 10000000;
+	utc.hsec = (hsec < 0) ? 0 : (hsec > 99) ? 99 : hsec;
+	if (p[11] & PVT_VALID_DATE) {
+		utc.year = getU2(p + 4) - 1900;
+		utc.mon = p[6] - 1;
+		utc.day = p[7];
+	} else {
+		// No date, like the empty date field of an RMC
+		utc.mon = -1;
+	}
+
+	fixType = p[20];
+	flags = p[21];
+	fix = (flags & PVT_FIX_OK) && fixType >= 2 && fixType <= 4;
+
+	nmea_zero_GPGGA(gga);
+	gga->utc = utc;
+	gga->lat = toNDEG(getI4(p + 28), &gga->ns, 'N', 'S', &gga->lat_nano);
+	gga->lon = toNDEG(getI4(p + 24), &gga->ew, 'E', 'W', &gga->lon_nano);
+	gga->sig = !fix ? 0 : (flags & PVT_DIFF_SOLN) ? 2 : 1;
+	gga->satinuse = p[23];
+	gga->HDOP = getU2(p + 76) * 0.01;
+	gga->elv = getI4(p + 36) * 1e-3;
+	gga->elv_units = 'M';
+	gga->diff = (getI4(p + 32) - getI4(p + 36)) * 1e-3;
+	gga->diff_units = 'M';
+
+	nmea_zero_GPRMC(rmc);
+	rmc->utc = utc;
+	rmc->status = fix ? 'A' : 'V';
+	rmc->lat = gga->lat;
+	rmc->ns = gga->ns;
+	rmc->lon = gga->lon;
+	rmc->ew = gga->ew;
+	rmc->lat_nano = gga->lat_nano;
+	rmc->lon_nano = gga->lon_nano;
+	rmc->speed = getI4(p + 60) * 1e-3 * NMEA_TUS_MS / NMEA_TUD_KNOTS;
+	rmc->direction = getI4(p + 64) * 1e-5;
+	rmc->mode = !fix ? 'N' : (flags & PVT_DIFF_SOLN) ? 'D' : 'A';
+
+	nmea_zero_GPGSA(gsa);
+	gsa->fix_mode = 'A';
+	gsa->fix_type = !fix ? 1 : (fixType == 2) ? 2 : 3;
+	gsa->PDOP = gga->HDOP;
+
+	*accuracy = getU4(p + 40) * 1e-3f;
+	return 1;
+}
+
+// NMEA system and number of a satellite, 0 if NMEA has none for it
+static int satPRN(int gnssId, int svId, int *sys) {
+	switch (gnssId) {
+	case UBX_GNSS_GPS:
+		*sys = NMEA_SYS_GPS;
+		return (svId >= 1 && svId <= 32) ? svId : 0;
+	case UBX_GNSS_SBAS:
+		*sys = NMEA_SYS_GPS;
+		return (svId >= 120 && svId <= 151) ? svId - 87 : 0;
+	case UBX_GNSS_GLONASS:
+		*sys = NMEA_SYS_GLONASS;
+		return (svId >= 1 && svId <= 32) ? svId + 64 : 0;
+	case UBX_GNSS_GALILEO:
+		*sys = NMEA_SYS_GALILEO;
+		return (svId >= 1 && svId <= 36) ? svId : 0;
+	}
+	return 0;
+}
+
+// Sorts the satellites of a NAV-SAT by system. Those of other systems,
+// and past what a GSV set holds, are dropped.
+// Returns 0 if the frame is no NAV-SAT.
+int ubxParseSAT(const ubxFrame *frame, ubxSatellites *sats) {
+	const unsigned char *p = frame->payload;
+	nmeaSATELLITE *sat;
+	int num, it, sys, prn;
+
+	if (frame->cls != UBX_CLASS_NAV || frame->id != UBX_NAV_SAT || frame->len < UBX_NAV_SAT_HEADER)
+		return 0;
+	num = p[5];
+	if (p[4] != 1 || frame->len < UBX_NAV_SAT_HEADER + num * UBX_NAV_SAT_BLOCK)
+		return 0;
+
+	memset(sats->count, 0, sizeof(sats->count));
+	for (it = 0, p += UBX_NAV_SAT_HEADER; it < num; it++, p += UBX_NAV_SAT_BLOCK) {
+		prn = satPRN(p[0], p[1], &sys);
+		if (prn == 0 || sats->count[sys] >= NMEA_MAXSATVIEW)
+			continue;
+		sat = &sats->sat[sys][sats->count[sys]++];
+		sat->id = prn;
+		sat->sig = p[2];
+		// Out of range is unknown
+		sat->elv = (signed char)p[3];
+		if (sat->elv < -90 || sat->elv > 90)
+			sat->elv = 0;
+		sat->azimuth = getI2(p + 4);
+		if (sat->azimuth < 0 || sat->azimuth > 360)
+			sat->azimuth = 0;
+		sat->in_use = (getU4(p + 8) & SAT_USED) != 0;
+	}
+	return 1;
+}
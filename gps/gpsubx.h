@@ -0,0 +1,52 @@
+// NI Adam GPS library
+// u-blox UBX binary protocol: frames and the navigation messages
+
+#ifndef GPSUBX_H
+#define GPSUBX_H
+
+#include "nmea/nmea/nmea.h"
+
+#define UBX_SYNC1 0xB5
+#define UBX_SYNC2 0x62
+// Sync, class, id and length before the payload, checksum after it
+#define UBX_HEADER 6
+#define UBX_OVERHEAD 8
+// Longer frames are taken for noise, NAV-SAT with 80 satellites fits
+#define UBX_MAX_PAYLOAD 1024
+
+#define UBX_CLASS_NAV 0x01
+#define UBX_NAV_PVT 0x07
+#define UBX_NAV_SAT 0x35
+#define UBX_NAV_PVT_LEN 92
+#define UBX_NAV_SAT_HEADER 8
+#define UBX_NAV_SAT_BLOCK 12
+
+// gnssId of the NAV messages
+#define UBX_GNSS_GPS 0
+#define UBX_GNSS_SBAS 1
+#define UBX_GNSS_GALILEO 2
+#define UBX_GNSS_GLONASS 6
+
+typedef struct _ubxFrame
+{
+	int			cls;
+	int			id;
+	int			len;		// Of the payload
+	const unsigned char	*payload;
+} ubxFrame;
+
+// Satellites of a NAV-SAT by system, numbered as NMEA does
+typedef struct _ubxSatellites
+{
+	int		count[NMEA_NSYS];
+	nmeaSATELLITE	sat[NMEA_NSYS][NMEA_MAXSATVIEW];
+} ubxSatellites;
+
+int ubxCheckFrame(const unsigned char *buf, int len, ubxFrame *frame);
+int ubxWriteFrame(unsigned char *buf, int size, int cls, int id,
+	const unsigned char *payload, int len);
+int ubxParsePVT(const ubxFrame *frame, nmeaGPGGA *gga, nmeaGPRMC *rmc,
+	nmeaGPGSA *gsa, float *accuracy);
+int ubxParseSAT(const ubxFrame *frame, ubxSatellites *sats);
+
+#endif
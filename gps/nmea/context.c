@@ -17,7 +17,7 @@
 nmeaPROPERTY * nmea_property()
 {
     static nmeaPROPERTY prop = {
-        0, 0, NMEA_DEF_PARSEBUFF
+        0, 0, NMEA_DEF_PARSEBUFF, NMEA_DEF_PARSEPOOL
         };
 
     return &prop;
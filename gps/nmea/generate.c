@@ -11,6 +11,7 @@
 #include "nmea/tok.h"
 #include "nmea/sentence.h"
 #include "nmea/generate.h"
+#include "nmea/gmath.h"
 #include "nmea/units.h"
 
 #include <string.h>
@@ -82,6 +83,8 @@ void nmea_info2GPGGA(const nmeaINFO *info, nmeaGPGGA *pack)
     pack->ns = ((info->lat > 0)?'N':'S');
     pack->lon = fabs(info->lon);
     pack->ew = ((info->lon > 0)?'E':'W');
+    pack->lat_nano = nmea_ndeg2nano(info->lat);
+    pack->lon_nano = nmea_ndeg2nano(info->lon);
     pack->sig = info->sig;
     pack->satinuse = info->satinfo.inuse;
     pack->HDOP = info->HDOP;
@@ -147,6 +150,8 @@ void nmea_info2GPRMC(const nmeaINFO *info, nmeaGPRMC *pack)
     pack->ns = ((info->lat > 0)?'N':'S');
     pack->lon = fabs(info->lon);
     pack->ew = ((info->lon > 0)?'E':'W');
+    pack->lat_nano = nmea_ndeg2nano(info->lat);
+    pack->lon_nano = nmea_ndeg2nano(info->lon);
     pack->speed = info->speed / NMEA_TUD_KNOTS;
     pack->direction = info->direction;
     pack->declination = info->declination;
@@ -15,6 +15,8 @@
 
 #define NMEA_DEF_PARSEBUFF  (1024)
 #define NMEA_MIN_PARSEBUFF  (256)
+#define NMEA_DEF_PARSEPOOL  (32)
+#define NMEA_MIN_PARSEPOOL  (1)
 
 #ifdef  __cplusplus
 extern "C" {
@@ -28,6 +30,7 @@ typedef struct _nmeaPROPERTY
     nmeaTraceFunc   trace_func;
     nmeaErrorFunc   error_func;
     int             parse_buff_size;
+    int             parse_pool_size;    /**< Packets a parser can hold before popped */
 
 } nmeaPROPERTY;
 
@@ -20,7 +20,9 @@
 #define NMEA_EARTH_SEMIMAJORAXIS_M  (6378137.0)                     /**< Earth's semi-major axis in m according WGS84 */
 #define NMEA_EARTH_SEMIMAJORAXIS_KM (NMEA_EARTHMAJORAXIS_KM / 1000) /**< Earth's semi-major axis in km according WGS 84 */
 #define NMEA_EARTH_FLATTENING       (1 / 298.257223563)             /**< Earth's flattening according WGS 84 */
+#define NMEA_EARTH_MEANRADIUS_M     (6371008.8)                     /**< Earth's mean radius (2a + b) / 3 in m according WGS 84 */
 #define NMEA_DOP_FACTOR             (5)                             /**< Factor for translating DOP to meters */
+#define NMEA_NDEG_NANO_MAX          (100000000)                     /**< No coordinate in NDEG reaches it, nano-degrees of it would overflow */
 
 #ifdef  __cplusplus
 extern "C" {
@@ -39,6 +41,7 @@ double nmea_radian2degree(double val);
 
 double nmea_ndeg2degree(double val);
 double nmea_degree2ndeg(double val);
+long long nmea_ndeg2nano(double val);
 
 double nmea_ndeg2radian(double val);
 double nmea_radian2ndeg(double val);
@@ -85,6 +88,33 @@ int     nmea_move_horz_ellipsoid(
         double *end_azimuth
         );
 
+/*
+ * batch work, positions in separate latitude and longitude arrays (radians)
+ */
+
+void    nmea_distance_batch(
+        const double *from_lat, const double *from_lon,
+        const double *to_lat, const double *to_lon,
+        int count,
+        double *distance,
+        double *azimuth
+        );
+
+void    nmea_distance_ellipsoid_batch(
+        const double *from_lat, const double *from_lon,
+        const double *to_lat, const double *to_lon,
+        int count,
+        double *distance,
+        double *from_azimuth,
+        double *to_azimuth
+        );
+
+double  nmea_track_length(
+        const double *lat, const double *lon,
+        int count,
+        double *cumulative
+        );
+
 #ifdef  __cplusplus
 }
 #endif
@@ -16,6 +16,7 @@
 #include "./gmath.h"
 #include "./info.h"
 #include "./sentence.h"
+#include "./sattab.h"
 #include "./generate.h"
 #include "./generator.h"
 #include "./parse.h"
@@ -18,7 +18,9 @@ extern "C" {
 #endif
 
 int nmea_pack_type(const char *buff, int buff_sz);
+int nmea_pack_talker(const char *buff, int buff_sz);
 int nmea_find_tail(const char *buff, int buff_sz, int *res_crc);
+int nmea_find_tail_wrap(const char *buff, int buff_sz, const char *wrap, int wrap_sz, int *res_crc);
 
 int nmea_parse_GPGGA(const char *buff, int buff_sz, nmeaGPGGA *pack);
 int nmea_parse_GPGSA(const char *buff, int buff_sz, nmeaGPGSA *pack);
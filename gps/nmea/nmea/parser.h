@@ -25,9 +25,15 @@ typedef struct _nmeaPARSER
 {
     void *top_node;
     void *end_node;
-    unsigned char *buffer;
+    unsigned char *buffer;  /**< Ring of buff_size bytes, then as much room to unwrap a sentence */
     int buff_size;
     int buff_use;
+    int buff_head;          /**< Ring offset of the oldest unparsed byte */
+    int buff_overflow;      /**< Times the ring was full of data without a sentence end */
+    void *pool;         /**< Packet nodes, allocated once by nmea_parser_init */
+    void *free_node;    /**< Unused nodes of the pool */
+    void *pop_node;     /**< Node of the last popped packet, reused by the next call */
+    int pool_size;
 
 } nmeaPARSER;
 
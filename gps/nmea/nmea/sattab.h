@@ -0,0 +1,76 @@
+/*
+ *
+ * NMEA library
+ * URL: http://nmea.sourceforge.net
+ * Author: Tim (xtimor@gmail.com)
+ * Licence: http://www.gnu.org/licenses/lgpl.html
+ *
+ */
+
+/*! \file */
+
+#ifndef __NMEA_SATTAB_H__
+#define __NMEA_SATTAB_H__
+
+#include "sentence.h"
+
+#define NMEA_MAXGSV         (9)     /**< GSV messages in the set of one system */
+#define NMEA_MAXSATVIEW     (NMEA_MAXGSV * NMEA_SATINPACK)
+#define NMEA_NGSVSET        (NMEA_TALKER_GA + 1)    /**< GSV sets, one per talker (nmeaTALKER) */
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Satellite system of the table entries
+ * @see nmea_sattab_system
+ */
+enum nmeaSYSTEM
+{
+    NMEA_SYS_GPS        = 0,    /**< GPS and SBAS, PRN 1 - 64 */
+    NMEA_SYS_GLONASS    = 1,    /**< GLONASS, PRN 65 - 96 */
+    NMEA_SYS_GALILEO    = 2,    /**< Galileo, PRN 1 - 36 */
+    NMEA_NSYS           = 3
+};
+
+/**
+ * Satellites in view of all systems, reassembled from the GSV sets of
+ * each talker. The columns are allocated once by nmea_sattab_init,
+ * entry i of the table is prn[i], elv[i], azimuth[i], sig[i], sys[i]
+ * and set[i].
+ * @see nmea_sattab_GSV
+ * @see nmea_sattab_GSA
+ */
+typedef struct _nmeaSATTAB
+{
+    int     capacity;       /**< Entries the columns hold */
+    int     count;          /**< Entries in use */
+    short  *prn;            /**< Satellite PRN number */
+    short  *elv;            /**< Elevation in degrees, 90 maximum */
+    short  *azimuth;        /**< Azimuth, degrees from true north, 000 to 359 */
+    short  *sig;            /**< Signal, 00-99 dB */
+    unsigned char *sys;     /**< System of the satellite (nmeaSYSTEM) */
+    unsigned char *set;     /**< Talker of the GSV set that reported it (nmeaTALKER) */
+    unsigned long long used[NMEA_NSYS]; /**< Used in fix, bit (PRN - first PRN of the system) */
+    int     gsv_count[NMEA_NGSVSET];    /**< Messages in the GSV set being reassembled */
+    int     gsv_mask[NMEA_NGSVSET];     /**< Messages of that set received, bit (index - 1) */
+    unsigned int gsv_resets;        /**< Sets started over before they were complete */
+
+} nmeaSATTAB;
+
+int     nmea_sattab_init(nmeaSATTAB *tab, int capacity);
+void    nmea_sattab_destroy(nmeaSATTAB *tab);
+void    nmea_sattab_clear(nmeaSATTAB *tab);
+void    nmea_sattab_clear_used(nmeaSATTAB *tab);
+
+int     nmea_sattab_system(int talker, int prn);
+int     nmea_sattab_GSV(nmeaSATTAB *tab, int talker, const nmeaGPGSV *pack);
+void    nmea_sattab_GSA(nmeaSATTAB *tab, int talker, const nmeaGPGSA *pack);
+int     nmea_sattab_in_use(const nmeaSATTAB *tab, int idx);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* __NMEA_SATTAB_H__ */
@@ -32,6 +32,18 @@ enum nmeaPACKTYPE
     GPVTG   = 0x0010    /**< VTG - Actual track made good and speed over ground. */
 };
 
+/**
+ * Talkers of the packets, a packet type covers all of them
+ */
+enum nmeaTALKER
+{
+    NMEA_TALKER_NON = 0,    /**< Unknown talker. */
+    NMEA_TALKER_GP  = 1,    /**< GPS */
+    NMEA_TALKER_GN  = 2,    /**< Combined GNSS solution */
+    NMEA_TALKER_GL  = 3,    /**< GLONASS */
+    NMEA_TALKER_GA  = 4     /**< Galileo */
+};
+
 /**
  * GGA packet information structure (Global Positioning System Fix Data)
  */
@@ -42,6 +54,8 @@ typedef struct _nmeaGPGGA
     char    ns;         /**< [N]orth or [S]outh */
 	double  lon;        /**< Longitude in NDEG - [degree][min].[sec/60] */
     char    ew;         /**< [E]ast or [W]est */
+    long long lat_nano; /**< Latitude in nano-degrees, south is negative */
+    long long lon_nano; /**< Longitude in nano-degrees, west is negative */
     int     sig;        /**< GPS quality indicator (0 = Invalid; 1 = Fix; 2 = Differential, 3 = Sensitive) */
 	int     satinuse;   /**< Number of satellites in use (not those in view) */
     double  HDOP;       /**< Horizontal dilution of precision */
@@ -91,6 +105,8 @@ typedef struct _nmeaGPRMC
     char    ns;         /**< [N]orth or [S]outh */
 	double  lon;        /**< Longitude in NDEG - [degree][min].[sec/60] */
     char    ew;         /**< [E]ast or [W]est */
+    long long lat_nano; /**< Latitude in nano-degrees, south is negative */
+    long long lon_nano; /**< Longitude in nano-degrees, west is negative */
     double  speed;      /**< Speed over the ground in knots */
     double  direction;  /**< Track angle in degrees True */
     double  declination; /**< Magnetic variation degrees (Easterly var. subtracts from true course) */
@@ -13,16 +13,75 @@
 
 #include "config.h"
 
+#define NMEA_MAXFIELDS      (24)
+
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Comma offsets of one sentence, found by nmea_split
+ */
+typedef struct _nmeaFIELDS
+{
+    const char *buff;   /**< Sentence the offsets refer to */
+    int     count;      /**< Number of fields before '*', the header is field 0 */
+    int     wide;       /**< Bit per field longer than one character */
+    int     beg[NMEA_MAXFIELDS + 1]; /**< Field starts, beg[count] is one past the '*' */
+
+} nmeaFIELDS;
+
 int     nmea_calc_crc(const char *buff, int buff_sz);
 int     nmea_atoi(const char *str, int str_sz, int radix);
 double  nmea_atof(const char *str, int str_sz);
 int     nmea_printf(char *buff, int buff_sz, const char *format, ...);
 int     nmea_scanf(const char *buff, int buff_sz, const char *format, ...);
 
+int     nmea_split(const char *buff, int buff_sz, nmeaFIELDS *fields);
+int     nmea_fixtoi(const char *str, int str_sz);
+double  nmea_fixtof(const char *str, int str_sz);
+long long nmea_fixtonano(const char *str, int str_sz, double *ndeg);
+
+/**
+ * \brief Length of field number idx
+ */
+static NMEA_INLINE int nmea_field_len(const nmeaFIELDS *fields, int idx)
+{
+    return fields->beg[idx + 1] - fields->beg[idx] - 1;
+}
+
+/**
+ * \brief Integer value of field number idx (0 if empty)
+ */
+static NMEA_INLINE int nmea_field_int(const nmeaFIELDS *fields, int idx)
+{
+    return nmea_fixtoi(fields->buff + fields->beg[idx], nmea_field_len(fields, idx));
+}
+
+/**
+ * \brief Fraction value of field number idx (0 if empty)
+ */
+static NMEA_INLINE double nmea_field_float(const nmeaFIELDS *fields, int idx)
+{
+    return nmea_fixtof(fields->buff + fields->beg[idx], nmea_field_len(fields, idx));
+}
+
+/**
+ * \brief Nano-degrees of NDEG field number idx (0 if empty), *ndeg gets its NDEG value
+ */
+static NMEA_INLINE long long nmea_field_nano(const nmeaFIELDS *fields, int idx, double *ndeg)
+{
+    return nmea_fixtonano(fields->buff + fields->beg[idx], nmea_field_len(fields, idx), ndeg);
+}
+
+/**
+ * \brief First character of field number idx (0 if empty)
+ */
+static NMEA_INLINE char nmea_field_char(const nmeaFIELDS *fields, int idx)
+{
+    return (nmea_field_len(fields, idx) > 0) ? fields->buff[fields->beg[idx]] : 0;
+}
+
 #ifdef  __cplusplus
 }
 #endif
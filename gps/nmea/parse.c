@@ -70,16 +70,27 @@ int _nmea_parse_time(const char *buff, int buff_sz, nmeaTIME *res)
     switch(buff_sz)
     {
     case sizeof("hhmmss") - 1:
-        success = (3 == nmea_scanf(buff, buff_sz,
-            "%2d%2d%2d", &(res->hour), &(res->min), &(res->sec)
-            ));
+        res->hour = nmea_fixtoi(buff, 2);
+        res->min = nmea_fixtoi(buff + 2, 2);
+        res->sec = nmea_fixtoi(buff + 4, 2);
+        success = 1;
         break;
     case sizeof("hhmmss.s") - 1:
     case sizeof("hhmmss.ss") - 1:
     case sizeof("hhmmss.sss") - 1:
-        success = (4 == nmea_scanf(buff, buff_sz,
-            "%2d%2d%2d.%d", &(res->hour), &(res->min), &(res->sec), &(res->hsec)
-            ));
+        res->hour = nmea_fixtoi(buff, 2);
+        res->min = nmea_fixtoi(buff + 2, 2);
+        res->sec = nmea_fixtoi(buff + 4, 2);
+        if('.' == buff[6])
+        {
+            /* The fraction has 1 - 3 digits, hsec is in hundredths */
+            res->hsec = nmea_fixtoi(buff + 7, buff_sz - 7);
+            if(buff_sz - 7 == 1)
+                res->hsec *= 10;
+            else if(buff_sz - 7 == 3)
+                res->hsec /= 10;
+            success = 1;
+        }
         break;
     default:
         nmea_error("Parse of time error (format error)!");
@@ -90,8 +101,155 @@ int _nmea_parse_time(const char *buff, int buff_sz, nmeaTIME *res)
     return (success?0:-1);        
 }
 
+/*
+ * Perfect hash of the five header characters after '$'. The four bytes
+ * after the leading 'G' are multiplied by NMEA_HEAD_HASH_MUL and the top
+ * five bits give a distinct slot for each of the 20 headers.
+ */
+#define NMEA_HEAD_HASH_MUL  (0x96380ED7UL)
+#define NMEA_HEAD_HASH_BITS (5)
+
+typedef struct _nmeaHEAD
+{
+    char    head[6];
+    int     type;
+    int     talker;
+
+} nmeaHEAD;
+
+static const nmeaHEAD nmea_heads[1 << NMEA_HEAD_HASH_BITS] = {
+    { "GNGGA", GPGGA, NMEA_TALKER_GN },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GAGSA", GPGSA, NMEA_TALKER_GA },
+    { "GNVTG", GPVTG, NMEA_TALKER_GN },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GLGSV", GPGSV, NMEA_TALKER_GL },
+    { "GPGGA", GPGGA, NMEA_TALKER_GP },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GPVTG", GPVTG, NMEA_TALKER_GP },
+    { "GLRMC", GPRMC, NMEA_TALKER_GL },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GNGSV", GPGSV, NMEA_TALKER_GN },
+    { "GAGGA", GPGGA, NMEA_TALKER_GA },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GNRMC", GPRMC, NMEA_TALKER_GN },
+    { "GAVTG", GPVTG, NMEA_TALKER_GA },
+    { "GPGSV", GPGSV, NMEA_TALKER_GP },
+    { "GLGSA", GPGSA, NMEA_TALKER_GL },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GPRMC", GPRMC, NMEA_TALKER_GP },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GNGSA", GPGSA, NMEA_TALKER_GN },
+    { "GAGSV", GPGSV, NMEA_TALKER_GA },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "GARMC", GPRMC, NMEA_TALKER_GA },
+    { "GLGGA", GPGGA, NMEA_TALKER_GL },
+    { "GPGSA", GPGSA, NMEA_TALKER_GP },
+    { "GLVTG", GPVTG, NMEA_TALKER_GL },
+    { "",      GPNON, NMEA_TALKER_NON },
+    { "",      GPNON, NMEA_TALKER_NON }
+};
+
+static const nmeaHEAD * _nmea_head(const char *buff, int buff_sz)
+{
+    const unsigned char *ubuff = (const unsigned char *)buff;
+    const nmeaHEAD *head;
+    unsigned long key;
+
+    if(buff_sz < 5)
+        return 0;
+
+    key = (unsigned long)ubuff[1] | ((unsigned long)ubuff[2] << 8) |
+        ((unsigned long)ubuff[3] << 16) | ((unsigned long)ubuff[4] << 24);
+    head = &nmea_heads[((key * NMEA_HEAD_HASH_MUL) & 0xFFFFFFFFUL) >> (32 - NMEA_HEAD_HASH_BITS)];
+
+    if(0 != memcmp(buff, head->head, 5))
+        return 0;
+
+    return head;
+}
+
+/*
+ * Fields read with %C by the nmea_scanf formats below. nmea_scanf stops
+ * at a %C field longer than one character, so those sentences are left
+ * to it.
+ */
+#define NMEA_FIELD(n)       (1 << (n))
+#define NMEA_GGA_CHARS      (NMEA_FIELD(3) | NMEA_FIELD(5) | NMEA_FIELD(10) | NMEA_FIELD(12))
+#define NMEA_GSA_CHARS      (NMEA_FIELD(1))
+#define NMEA_RMC_CHARS      (NMEA_FIELD(2) | NMEA_FIELD(4) | NMEA_FIELD(6))
+#define NMEA_VTG_CHARS      (NMEA_FIELD(2) | NMEA_FIELD(4) | NMEA_FIELD(6))
+
+/**
+ * \brief Check the '$' and the header of a packet of the given type, any talker.
+ * The nmea_scanf formats below start after it.
+ */
+static int _nmea_check_head(const char *buff, int buff_sz, int type)
+{
+    const nmeaHEAD *head;
+
+    if(buff_sz < 6 || '$' != buff[0])
+        return 0;
+
+    head = _nmea_head(buff + 1, buff_sz - 1);
+
+    return (head && head->type == type);
+}
+
+/**
+ * \brief Split a sentence of the given type for the direct field parsers.
+ * @return Number of fields or -1 if the sentence must go through nmea_scanf.
+ */
+static int _nmea_split(const char *buff, int buff_sz, int type, nmeaFIELDS *fields)
+{
+    /* nmea_atoi/nmea_atof give 0 for longer tokens */
+    if(buff_sz >= NMEA_CONVSTR_BUF)
+        return -1;
+    if(!_nmea_check_head(buff, buff_sz, type) ||
+        nmea_split(buff, buff_sz, fields) < 2 || nmea_field_len(fields, 0) != 6)
+        return -1;
+
+    return fields->count;
+}
+
+/**
+ * \brief Integer field of a split sentence, 0 past the last field.
+ */
+static int _nmea_field_int(const nmeaFIELDS *fields, int idx)
+{
+    return (idx < fields->count) ? nmea_field_int(fields, idx) : 0;
+}
+
+/**
+ * \brief Point at a string field of a split sentence.
+ * @return 0 if it holds a NUL and must go through nmea_scanf (%s and strlen).
+ */
+static int _nmea_field_str(const nmeaFIELDS *fields, int idx, const char **str, int *str_sz)
+{
+    *str = fields->buff + fields->beg[idx];
+    *str_sz = nmea_field_len(fields, idx);
+
+    return (0 == memchr(*str, '\0', *str_sz));
+}
+
+/**
+ * \brief Sign the nano-degrees of a position by its hemisphere, the one
+ * place it is done. Anything but N or E counts as south or west, as in
+ * nmea_GPGGA2info.
+ */
+static void _nmea_hemisphere(char ns, char ew, long long *lat_nano, long long *lon_nano)
+{
+    if('N' != ns)
+        *lat_nano = -*lat_nano;
+    if('E' != ew)
+        *lon_nano = -*lon_nano;
+}
+
 /**
  * \brief Define packet type by header (nmeaPACKTYPE).
+ * GN, GL and GA packets have the type of their GP counterpart.
  * @param buff a constant character pointer of packet buffer.
  * @param buff_sz buffer size.
  * @return The defined packet type
@@ -99,30 +257,54 @@ int _nmea_parse_time(const char *buff, int buff_sz, nmeaTIME *res)
  */
 int nmea_pack_type(const char *buff, int buff_sz)
 {
-    static const char *pheads[] = {
-        "GPGGA",
-        "GPGSA",
-        "GPGSV",
-        "GPRMC",
-        "GPVTG",
-    };
+    const nmeaHEAD *head;
 
     NMEA_ASSERT(buff);
 
-    if(buff_sz < 5)
-        return GPNON;
-    else if(0 == memcmp(buff, pheads[0], 5))
-        return GPGGA;
-    else if(0 == memcmp(buff, pheads[1], 5))
-        return GPGSA;
-    else if(0 == memcmp(buff, pheads[2], 5))
-        return GPGSV;
-    else if(0 == memcmp(buff, pheads[3], 5))
-        return GPRMC;
-    else if(0 == memcmp(buff, pheads[4], 5))
-        return GPVTG;
-
-    return GPNON;
+    head = _nmea_head(buff, buff_sz);
+
+    return head ? head->type : GPNON;
+}
+
+/**
+ * \brief Define packet talker by header (nmeaTALKER).
+ * @param buff a constant character pointer of packet buffer.
+ * @param buff_sz buffer size.
+ * @return The talker of a known packet type
+ * @see nmeaTALKER
+ */
+int nmea_pack_talker(const char *buff, int buff_sz)
+{
+    const nmeaHEAD *head;
+
+    NMEA_ASSERT(buff);
+
+    head = _nmea_head(buff, buff_sz);
+
+    return head ? head->talker : NMEA_TALKER_NON;
+}
+
+/**
+ * \brief Value of the two hex digits of a checksum, -1 if they are not.
+ */
+static int _nmea_crc_hex(const char *str)
+{
+    int i, digit, res = 0;
+
+    for(i = 0; i < 2; ++i)
+    {
+        if(str[i] >= '0' && str[i] <= '9')
+            digit = str[i] - '0';
+        else if(str[i] >= 'A' && str[i] <= 'F')
+            digit = str[i] - 'A' + 10;
+        else if(str[i] >= 'a' && str[i] <= 'f')
+            digit = str[i] - 'a' + 10;
+        else
+            return -1;
+        res = (res << 4) | digit;
+    }
+
+    return res;
 }
 
 /**
@@ -136,44 +318,112 @@ int nmea_find_tail(const char *buff, int buff_sz, int *res_crc)
 {
     static const int tail_sz = 3 /* *[CRC] */ + 2 /* \r\n */;
 
-    const char *end_buff = buff + buff_sz;
-    int nread = 0;
+    /* SWAR constants, a byte of the word is zero if (w - ones) & ~w & highs */
+    const unsigned long ones = ~0UL / 0xFF;
+    const unsigned long highs = ones << 7;
+    const unsigned long stars = ones * '*';
+    const unsigned long dollars = ones * '$';
+
+    unsigned long word, acc = 0;
+    int nread = 0, shift;
     int crc = 0;
 
     NMEA_ASSERT(buff && res_crc);
 
     *res_crc = -1;
 
-    for(;buff < end_buff; ++buff, ++nread)
+    /* XOR a word at a time until one holds a '*' or '$' */
+    if(buff_sz > 0 && '*' != buff[0])
     {
-        if(('$' == *buff) && nread)
+        for(nread = 1; nread + (int)sizeof(word) <= buff_sz; nread += (int)sizeof(word))
         {
-            buff = 0;
-            break;
+            memcpy(&word, buff + nread, sizeof(word));
+            if(((word ^ stars) - ones) & ~(word ^ stars) & highs)
+                break;
+            if(((word ^ dollars) - ones) & ~(word ^ dollars) & highs)
+                break;
+            acc ^= word;
         }
-        else if('*' == *buff)
+
+        for(shift = (int)sizeof(acc) * 4; shift >= 8; shift /= 2)
+            acc ^= acc >> shift;
+        crc = (int)(acc & 0xFF);
+    }
+
+    /* the rest byte by byte */
+    for(; nread < buff_sz; ++nread)
+    {
+        if(('$' == buff[nread]) && nread)
+            return nread;
+        else if('*' == buff[nread])
         {
-            if(buff + tail_sz <= end_buff && '\r' == buff[3] && '\n' == buff[4])
-            {
-                *res_crc = nmea_atoi(buff + 1, 2, 16);
-                nread = buff_sz - (int)(end_buff - (buff + tail_sz));
-                if(*res_crc != crc)
-                {
-                    *res_crc = -1;
-                    buff = 0;
-                }
-            }
+            if(nread + tail_sz > buff_sz || '\r' != buff[nread + 3] || '\n' != buff[nread + 4])
+                return 0;
+
+            *res_crc = _nmea_crc_hex(buff + nread + 1);
+            if(*res_crc != crc)
+                *res_crc = -1;
+
+            return nread + tail_sz;
+        }
+        else if(nread)
+            crc ^= (unsigned char)buff[nread];
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Same as nmea_find_tail for a packet that goes on from the end of
+ * buff at the start of wrap (unparsed data of a ring buffer).
+ * @param buff a constant character pointer of packets buffer.
+ * @param buff_sz buffer size.
+ * @param wrap a constant character pointer of the buffer continuation.
+ * @param wrap_sz continuation size.
+ * @param res_crc a integer pointer for return CRC of packet (must be defined).
+ * @return Number of bytes to packet tail, counted over both parts.
+ */
+int nmea_find_tail_wrap(const char *buff, int buff_sz, const char *wrap, int wrap_sz, int *res_crc)
+{
+    static const int tail_sz = 3 /* *[CRC] */ + 2 /* \r\n */;
+
+    int nread, total = buff_sz + wrap_sz;
+    int crc = 0;
+    char crc_buff[2];
+
+    NMEA_ASSERT(buff && res_crc);
+
+#define NMEA_WRAP_AT(i) (((i) < buff_sz) ? buff[i] : wrap[(i) - buff_sz])
+
+    *res_crc = -1;
+
+    for(nread = 0; nread < total; ++nread)
+    {
+        char c = NMEA_WRAP_AT(nread);
+
+        if(('$' == c) && nread)
+            return nread;
+        else if('*' == c)
+        {
+            if(nread + tail_sz > total ||
+                '\r' != NMEA_WRAP_AT(nread + 3) || '\n' != NMEA_WRAP_AT(nread + 4))
+                return 0;
 
-            break;
+            crc_buff[0] = NMEA_WRAP_AT(nread + 1);
+            crc_buff[1] = NMEA_WRAP_AT(nread + 2);
+            *res_crc = _nmea_crc_hex(&crc_buff[0]);
+            if(*res_crc != crc)
+                *res_crc = -1;
+
+            return nread + tail_sz;
         }
         else if(nread)
-            crc ^= (int)*buff;
+            crc ^= (unsigned char)c;
     }
 
-    if(*res_crc < 0 && buff)
-        nread = 0;
+#undef NMEA_WRAP_AT
 
-    return nread;
+    return 0;
 }
 
 /**
@@ -186,6 +436,9 @@ int nmea_find_tail(const char *buff, int buff_sz, int *res_crc)
 int nmea_parse_GPGGA(const char *buff, int buff_sz, nmeaGPGGA *pack)
 {
     char time_buff[NMEA_TIMEPARSE_BUF];
+    const char *time_str;
+    int time_sz;
+    nmeaFIELDS f;
 
     NMEA_ASSERT(buff && pack);
 
@@ -193,18 +446,49 @@ int nmea_parse_GPGGA(const char *buff, int buff_sz, nmeaGPGGA *pack)
 
     nmea_trace_buff(buff, buff_sz);
 
-    if(14 != nmea_scanf(buff, buff_sz,
-        "$GPGGA,%s,%f,%C,%f,%C,%d,%d,%f,%f,%C,%f,%C,%f,%d*",
-        &(time_buff[0]),
-        &(pack->lat), &(pack->ns), &(pack->lon), &(pack->ew),
-        &(pack->sig), &(pack->satinuse), &(pack->HDOP), &(pack->elv), &(pack->elv_units),
-        &(pack->diff), &(pack->diff_units), &(pack->dgps_age), &(pack->dgps_sid)))
+    if(_nmea_split(buff, buff_sz, GPGGA, &f) >= 15 && !(f.wide & NMEA_GGA_CHARS) &&
+        _nmea_field_str(&f, 1, &time_str, &time_sz))
     {
-        nmea_error("GPGGA parse error!");
-        return 0;
+        pack->lat_nano = nmea_field_nano(&f, 2, &(pack->lat));
+        pack->ns = nmea_field_char(&f, 3);
+        pack->lon_nano = nmea_field_nano(&f, 4, &(pack->lon));
+        pack->ew = nmea_field_char(&f, 5);
+        pack->sig = nmea_field_int(&f, 6);
+        pack->satinuse = nmea_field_int(&f, 7);
+        pack->HDOP = nmea_field_float(&f, 8);
+        pack->elv = nmea_field_float(&f, 9);
+        pack->elv_units = nmea_field_char(&f, 10);
+        pack->diff = nmea_field_float(&f, 11);
+        pack->diff_units = nmea_field_char(&f, 12);
+        pack->dgps_age = nmea_field_float(&f, 13);
+        pack->dgps_sid = nmea_field_int(&f, 14);
     }
+    else
+    {
+        /* An empty time field is not copied */
+        time_buff[0] = '\0';
+
+        if(!_nmea_check_head(buff, buff_sz, GPGGA) ||
+            14 != nmea_scanf(buff + 6, buff_sz - 6,
+            ",%s,%f,%C,%f,%C,%d,%d,%f,%f,%C,%f,%C,%f,%d*",
+            &(time_buff[0]),
+            &(pack->lat), &(pack->ns), &(pack->lon), &(pack->ew),
+            &(pack->sig), &(pack->satinuse), &(pack->HDOP), &(pack->elv), &(pack->elv_units),
+            &(pack->diff), &(pack->diff_units), &(pack->dgps_age), &(pack->dgps_sid)))
+        {
+            nmea_error("GPGGA parse error!");
+            return 0;
+        }
+
+        pack->lat_nano = nmea_ndeg2nano(pack->lat);
+        pack->lon_nano = nmea_ndeg2nano(pack->lon);
+        time_str = &time_buff[0];
+        time_sz = (int)strlen(&time_buff[0]);
+    }
+
+    _nmea_hemisphere(pack->ns, pack->ew, &(pack->lat_nano), &(pack->lon_nano));
 
-    if(0 != _nmea_parse_time(&time_buff[0], (int)strlen(&time_buff[0]), &(pack->utc)))
+    if(0 != _nmea_parse_time(time_str, time_sz, &(pack->utc)))
     {
         nmea_error("GPGGA time parse error!");
         return 0;
@@ -222,14 +506,28 @@ int nmea_parse_GPGGA(const char *buff, int buff_sz, nmeaGPGGA *pack)
  */
 int nmea_parse_GPGSA(const char *buff, int buff_sz, nmeaGPGSA *pack)
 {
+    nmeaFIELDS f;
+    int i;
+
     NMEA_ASSERT(buff && pack);
 
     memset(pack, 0, sizeof(nmeaGPGSA));
 
     nmea_trace_buff(buff, buff_sz);
 
-    if(17 != nmea_scanf(buff, buff_sz,
-        "$GPGSA,%C,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f*",
+    if(_nmea_split(buff, buff_sz, GPGSA, &f) >= 18 && !(f.wide & NMEA_GSA_CHARS))
+    {
+        pack->fix_mode = nmea_field_char(&f, 1);
+        pack->fix_type = nmea_field_int(&f, 2);
+        for(i = 0; i < NMEA_MAXSAT; ++i)
+            pack->sat_prn[i] = nmea_field_int(&f, 3 + i);
+        pack->PDOP = nmea_field_float(&f, 15);
+        pack->HDOP = nmea_field_float(&f, 16);
+        pack->VDOP = nmea_field_float(&f, 17);
+    }
+    else if(!_nmea_check_head(buff, buff_sz, GPGSA) ||
+        17 != nmea_scanf(buff + 6, buff_sz - 6,
+        ",%C,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f*",
         &(pack->fix_mode), &(pack->fix_type),
         &(pack->sat_prn[0]), &(pack->sat_prn[1]), &(pack->sat_prn[2]), &(pack->sat_prn[3]), &(pack->sat_prn[4]), &(pack->sat_prn[5]),
         &(pack->sat_prn[6]), &(pack->sat_prn[7]), &(pack->sat_prn[8]), &(pack->sat_prn[9]), &(pack->sat_prn[10]), &(pack->sat_prn[11]),
@@ -251,7 +549,8 @@ int nmea_parse_GPGSA(const char *buff, int buff_sz, nmeaGPGSA *pack)
  */
 int nmea_parse_GPGSV(const char *buff, int buff_sz, nmeaGPGSV *pack)
 {
-    int nsen, nsat;
+    int nsen, nsat, i;
+    nmeaFIELDS f;
 
     NMEA_ASSERT(buff && pack);
 
@@ -259,17 +558,37 @@ int nmea_parse_GPGSV(const char *buff, int buff_sz, nmeaGPGSV *pack)
 
     nmea_trace_buff(buff, buff_sz);
 
-    nsen = nmea_scanf(buff, buff_sz,
-        "$GPGSV,%d,%d,%d,"
-        "%d,%d,%d,%d,"
-        "%d,%d,%d,%d,"
-        "%d,%d,%d,%d,"
-        "%d,%d,%d,%d*",
-        &(pack->pack_count), &(pack->pack_index), &(pack->sat_count),
-        &(pack->sat_data[0].id), &(pack->sat_data[0].elv), &(pack->sat_data[0].azimuth), &(pack->sat_data[0].sig),
-        &(pack->sat_data[1].id), &(pack->sat_data[1].elv), &(pack->sat_data[1].azimuth), &(pack->sat_data[1].sig),
-        &(pack->sat_data[2].id), &(pack->sat_data[2].elv), &(pack->sat_data[2].azimuth), &(pack->sat_data[2].sig),
-        &(pack->sat_data[3].id), &(pack->sat_data[3].elv), &(pack->sat_data[3].azimuth), &(pack->sat_data[3].sig));
+    if(_nmea_split(buff, buff_sz, GPGSV, &f) > 0)
+    {
+        nsen = f.count - 1;
+        if(nsen > NMEA_SATINPACK * 4 + 3)
+            nsen = NMEA_SATINPACK * 4 + 3;
+
+        pack->pack_count = _nmea_field_int(&f, 1);
+        pack->pack_index = _nmea_field_int(&f, 2);
+        pack->sat_count = _nmea_field_int(&f, 3);
+        for(i = 0; i < NMEA_SATINPACK; ++i)
+        {
+            pack->sat_data[i].id = _nmea_field_int(&f, 4 + i * 4);
+            pack->sat_data[i].elv = _nmea_field_int(&f, 5 + i * 4);
+            pack->sat_data[i].azimuth = _nmea_field_int(&f, 6 + i * 4);
+            pack->sat_data[i].sig = _nmea_field_int(&f, 7 + i * 4);
+        }
+    }
+    else
+    {
+        nsen = !_nmea_check_head(buff, buff_sz, GPGSV) ? 0 : nmea_scanf(buff + 6, buff_sz - 6,
+            ",%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d*",
+            &(pack->pack_count), &(pack->pack_index), &(pack->sat_count),
+            &(pack->sat_data[0].id), &(pack->sat_data[0].elv), &(pack->sat_data[0].azimuth), &(pack->sat_data[0].sig),
+            &(pack->sat_data[1].id), &(pack->sat_data[1].elv), &(pack->sat_data[1].azimuth), &(pack->sat_data[1].sig),
+            &(pack->sat_data[2].id), &(pack->sat_data[2].elv), &(pack->sat_data[2].azimuth), &(pack->sat_data[2].sig),
+            &(pack->sat_data[3].id), &(pack->sat_data[3].elv), &(pack->sat_data[3].azimuth), &(pack->sat_data[3].sig));
+    }
 
     nsat = (pack->pack_index - 1) * NMEA_SATINPACK;
     nsat = (nsat + NMEA_SATINPACK > pack->sat_count)?pack->sat_count - nsat:NMEA_SATINPACK;
@@ -293,8 +612,11 @@ int nmea_parse_GPGSV(const char *buff, int buff_sz, nmeaGPGSV *pack)
  */
 int nmea_parse_GPRMC(const char *buff, int buff_sz, nmeaGPRMC *pack)
 {
-    int nsen;
+    int nsen, nfield;
     char time_buff[NMEA_TIMEPARSE_BUF];
+    const char *time_str;
+    int time_sz;
+    nmeaFIELDS f;
 
     NMEA_ASSERT(buff && pack);
 
@@ -302,13 +624,57 @@ int nmea_parse_GPRMC(const char *buff, int buff_sz, nmeaGPRMC *pack)
 
     nmea_trace_buff(buff, buff_sz);
 
-    nsen = nmea_scanf(buff, buff_sz,
-        "$GPRMC,%s,%C,%f,%C,%f,%C,%f,%f,%2d%2d%2d,%f,%C,%C*",
-        &(time_buff[0]),
-        &(pack->status), &(pack->lat), &(pack->ns), &(pack->lon), &(pack->ew),
-        &(pack->speed), &(pack->direction),
-        &(pack->utc.day), &(pack->utc.mon), &(pack->utc.year),
-        &(pack->declination), &(pack->declin_ew), &(pack->mode));
+    nfield = _nmea_split(buff, buff_sz, GPRMC, &f);
+
+    /*
+     * The mode field is optional. Whichever %C field comes last may be
+     * longer than one character, but an empty one followed or replaced by
+     * other fields is read as ',' or '*' by nmea_scanf.
+     */
+    if(nfield >= 12 && !(f.wide & NMEA_RMC_CHARS) && 6 == nmea_field_len(&f, 9) &&
+        (nfield == 13 || nmea_field_len(&f, nfield == 12 ? 11 : 12) > 0) &&
+        (nfield == 12 || !(f.wide & NMEA_FIELD(11))) &&
+        _nmea_field_str(&f, 1, &time_str, &time_sz))
+    {
+        const char *date = f.buff + f.beg[9];
+
+        pack->status = nmea_field_char(&f, 2);
+        pack->lat_nano = nmea_field_nano(&f, 3, &(pack->lat));
+        pack->ns = nmea_field_char(&f, 4);
+        pack->lon_nano = nmea_field_nano(&f, 5, &(pack->lon));
+        pack->ew = nmea_field_char(&f, 6);
+        pack->speed = nmea_field_float(&f, 7);
+        pack->direction = nmea_field_float(&f, 8);
+        pack->utc.day = nmea_fixtoi(date, 2);
+        pack->utc.mon = nmea_fixtoi(date + 2, 2);
+        pack->utc.year = nmea_fixtoi(date + 4, 2);
+        pack->declination = nmea_field_float(&f, 10);
+        pack->declin_ew = nmea_field_char(&f, 11);
+        nsen = 13;
+        if(nfield > 12)
+        {
+            pack->mode = nmea_field_char(&f, 12);
+            nsen = 14;
+        }
+    }
+    else
+    {
+        /* An empty time field is not copied */
+        time_buff[0] = '\0';
+
+        nsen = !_nmea_check_head(buff, buff_sz, GPRMC) ? 0 : nmea_scanf(buff + 6, buff_sz - 6,
+            ",%s,%C,%f,%C,%f,%C,%f,%f,%2d%2d%2d,%f,%C,%C*",
+            &(time_buff[0]),
+            &(pack->status), &(pack->lat), &(pack->ns), &(pack->lon), &(pack->ew),
+            &(pack->speed), &(pack->direction),
+            &(pack->utc.day), &(pack->utc.mon), &(pack->utc.year),
+            &(pack->declination), &(pack->declin_ew), &(pack->mode));
+
+        pack->lat_nano = nmea_ndeg2nano(pack->lat);
+        pack->lon_nano = nmea_ndeg2nano(pack->lon);
+        time_str = &time_buff[0];
+        time_sz = (int)strlen(&time_buff[0]);
+    }
 
     if(nsen != 13 && nsen != 14)
     {
@@ -316,7 +682,9 @@ int nmea_parse_GPRMC(const char *buff, int buff_sz, nmeaGPRMC *pack)
         return 0;
     }
 
-    if(0 != _nmea_parse_time(&time_buff[0], (int)strlen(&time_buff[0]), &(pack->utc)))
+    _nmea_hemisphere(pack->ns, pack->ew, &(pack->lat_nano), &(pack->lon_nano));
+
+    if(0 != _nmea_parse_time(time_str, time_sz, &(pack->utc)))
     {
         nmea_error("GPRMC time parse error!");
         return 0;
@@ -338,14 +706,33 @@ int nmea_parse_GPRMC(const char *buff, int buff_sz, nmeaGPRMC *pack)
  */
 int nmea_parse_GPVTG(const char *buff, int buff_sz, nmeaGPVTG *pack)
 {
+    nmeaFIELDS f;
+    int nfield;
+
     NMEA_ASSERT(buff && pack);
 
     memset(pack, 0, sizeof(nmeaGPVTG));
 
     nmea_trace_buff(buff, buff_sz);
 
-    if(8 != nmea_scanf(buff, buff_sz,
-        "$GPVTG,%f,%C,%f,%C,%f,%C,%f,%C*",
+    nfield = _nmea_split(buff, buff_sz, GPVTG, &f);
+
+    /* An empty unit followed by more fields is read as ',' by nmea_scanf */
+    if(nfield >= 9 && !(f.wide & NMEA_VTG_CHARS) &&
+        (nfield == 9 || nmea_field_len(&f, 8) > 0))
+    {
+        pack->dir = nmea_field_float(&f, 1);
+        pack->dir_t = nmea_field_char(&f, 2);
+        pack->dec = nmea_field_float(&f, 3);
+        pack->dec_m = nmea_field_char(&f, 4);
+        pack->spn = nmea_field_float(&f, 5);
+        pack->spn_n = nmea_field_char(&f, 6);
+        pack->spk = nmea_field_float(&f, 7);
+        pack->spk_k = nmea_field_char(&f, 8);
+    }
+    else if(!_nmea_check_head(buff, buff_sz, GPVTG) ||
+        8 != nmea_scanf(buff + 6, buff_sz - 6,
+        ",%f,%C,%f,%C,%f,%C,%f,%C*",
         &(pack->dir), &(pack->dir_t),
         &(pack->dec), &(pack->dec_m),
         &(pack->spn), &(pack->spn_n),
@@ -23,11 +23,89 @@
 typedef struct _nmeaParserNODE
 {
     int packType;
-    void *pack;
     struct _nmeaParserNODE *next_node;
+    union
+    {
+        nmeaGPGGA gga;
+        nmeaGPGSA gsa;
+        nmeaGPGSV gsv;
+        nmeaGPRMC rmc;
+        nmeaGPVTG vtg;
+    } data;
 
 } nmeaParserNODE;
 
+/**
+ * \brief Return a node to the pool
+ */
+static void nmea_parser_node_free(nmeaPARSER *parser, nmeaParserNODE *node)
+{
+    node->next_node = (nmeaParserNODE *)parser->free_node;
+    parser->free_node = node;
+}
+
+/**
+ * \brief Reuse the node handed out by the last pop
+ */
+static void nmea_parser_release_pop(nmeaPARSER *parser)
+{
+    if(parser->pop_node)
+    {
+        nmea_parser_node_free(parser, (nmeaParserNODE *)parser->pop_node);
+        parser->pop_node = 0;
+    }
+}
+
+/**
+ * \brief Take a node from the pool, the oldest queued packet if it is empty
+ */
+static nmeaParserNODE * nmea_parser_node_alloc(nmeaPARSER *parser)
+{
+    nmeaParserNODE *node = (nmeaParserNODE *)parser->free_node;
+
+    if(node)
+        parser->free_node = node->next_node;
+    else
+    {
+        node = (nmeaParserNODE *)parser->top_node;
+        parser->top_node = node->next_node;
+        if(!parser->top_node)
+            parser->end_node = 0;
+        nmea_error("Parser queue full, packet dropped!");
+    }
+
+    return node;
+}
+
+/**
+ * \brief Fill nmeaINFO structure by packet of any type
+ */
+static void nmea_parser_pack2info(int ptype, void *pack, nmeaINFO *info)
+{
+    switch(ptype)
+    {
+    case GPGGA:
+        nmea_GPGGA2info((nmeaGPGGA *)pack, info);
+        break;
+    case GPGSA:
+        nmea_GPGSA2info((nmeaGPGSA *)pack, info);
+        break;
+    case GPGSV:
+        nmea_GPGSV2info((nmeaGPGSV *)pack, info);
+        break;
+    case GPRMC:
+        nmea_GPRMC2info((nmeaGPRMC *)pack, info);
+        break;
+    case GPVTG:
+        nmea_GPVTG2info((nmeaGPVTG *)pack, info);
+        break;
+    };
+}
+
+static int nmea_parser_real_push(
+    nmeaPARSER *parser, const char *buff, int buff_sz,
+    nmeaINFO *info, int *npack);
+
 /*
  * high level
  */
@@ -38,21 +116,36 @@ typedef struct _nmeaParserNODE
  */
 int nmea_parser_init(nmeaPARSER *parser)
 {
-    int resv = 0;
+    int resv = 0, it;
     int buff_size = nmea_property()->parse_buff_size;
+    int pool_size = nmea_property()->parse_pool_size;
+    nmeaParserNODE *pool;
 
     NMEA_ASSERT(parser);
 
     if(buff_size < NMEA_MIN_PARSEBUFF)
         buff_size = NMEA_MIN_PARSEBUFF;
+    if(pool_size < NMEA_MIN_PARSEPOOL)
+        pool_size = NMEA_MIN_PARSEPOOL;
 
     memset(parser, 0, sizeof(nmeaPARSER));
 
-    if(0 == (parser->buffer = malloc(buff_size)))
+    /* the second half unwraps sentences that cross the end of the ring */
+    if(0 == (parser->buffer = malloc(buff_size * 2)))
         nmea_error("Insufficient memory!");
+    else if(0 == (pool = malloc(pool_size * sizeof(nmeaParserNODE))))
+    {
+        free(parser->buffer);
+        parser->buffer = 0;
+        nmea_error("Insufficient memory!");
+    }
     else
     {
         parser->buff_size = buff_size;
+        parser->pool = pool;
+        parser->pool_size = pool_size;
+        for(it = pool_size - 1; it >= 0; --it)
+            nmea_parser_node_free(parser, &pool[it]);
         resv = 1;
     }    
 
@@ -66,7 +159,7 @@ void nmea_parser_destroy(nmeaPARSER *parser)
 {
     NMEA_ASSERT(parser && parser->buffer);
     free(parser->buffer);
-    nmea_parser_queue_clear(parser);
+    free(parser->pool);
     memset(parser, 0, sizeof(nmeaPARSER));
 }
 
@@ -85,34 +178,16 @@ int nmea_parse(
 
     NMEA_ASSERT(parser && parser->buffer);
 
-    nmea_parser_push(parser, buff, buff_sz);
-
+    /* packets pushed before */
     while(GPNON != (ptype = nmea_parser_pop(parser, &pack)))
     {
         nread++;
-
-        switch(ptype)
-        {
-        case GPGGA:
-            nmea_GPGGA2info((nmeaGPGGA *)pack, info);
-            break;
-        case GPGSA:
-            nmea_GPGSA2info((nmeaGPGSA *)pack, info);
-            break;
-        case GPGSV:
-            nmea_GPGSV2info((nmeaGPGSV *)pack, info);
-            break;
-        case GPRMC:
-            nmea_GPRMC2info((nmeaGPRMC *)pack, info);
-            break;
-        case GPVTG:
-            nmea_GPVTG2info((nmeaGPVTG *)pack, info);
-            break;
-        };
-
-        free(pack);
+        nmea_parser_pack2info(ptype, pack, info);
     }
 
+    /* the rest goes straight to info, it needs no queue */
+    nmea_parser_real_push(parser, buff, buff_sz, info, &nread);
+
     return nread;
 }
 
@@ -120,173 +195,203 @@ int nmea_parse(
  * low level
  */
 
-int nmea_parser_real_push(nmeaPARSER *parser, const char *buff, int buff_sz)
+/**
+ * \brief Parse one whole sentence.
+ * The packet is queued, or given to info and counted in npack if info is set.
+ */
+static void nmea_parser_sentence(
+    nmeaPARSER *parser, const char *sen, int sen_sz,
+    nmeaINFO *info, int *npack)
 {
-    int nparsed = 0, crc, sen_sz, ptype;
-    nmeaParserNODE *node = 0;
-
-    NMEA_ASSERT(parser && parser->buffer);
+    int ptype, parsed;
+    nmeaParserNODE *node;
+    nmeaParserNODE scratch;
 
-    /* clear unuse buffer (for debug) */
-    /*
-    memset(
-        parser->buffer + parser->buff_use, 0,
-        parser->buff_size - parser->buff_use
-        );
-        */
+    ptype = nmea_pack_type(sen + 1, sen_sz - 1);
 
-    /* add */
-    if(parser->buff_use + buff_sz >= parser->buff_size)
-        nmea_parser_buff_clear(parser);
+    if(GPNON == ptype)
+        return;
 
-    memcpy(parser->buffer + parser->buff_use, buff, buff_sz);
-    parser->buff_use += buff_sz;
+    /* a full queue only gives up its oldest packet for one that parsed */
+    if(info || !parser->free_node)
+        node = &scratch;
+    else
+        node = nmea_parser_node_alloc(parser);
+    node->packType = ptype;
 
-    /* parse */
-    for(;;node = 0)
+    switch(ptype)
     {
-        sen_sz = nmea_find_tail(
-            (const char *)parser->buffer + nparsed,
-            (int)parser->buff_use - nparsed, &crc);
-
-        if(!sen_sz)
+    case GPGGA:
+        parsed = nmea_parse_GPGGA(sen, sen_sz, &node->data.gga);
+        break;
+    case GPGSA:
+        parsed = nmea_parse_GPGSA(sen, sen_sz, &node->data.gsa);
+        break;
+    case GPGSV:
+        parsed = nmea_parse_GPGSV(sen, sen_sz, &node->data.gsv);
+        break;
+    case GPRMC:
+        parsed = nmea_parse_GPRMC(sen, sen_sz, &node->data.rmc);
+        break;
+    case GPVTG:
+        parsed = nmea_parse_GPVTG(sen, sen_sz, &node->data.vtg);
+        break;
+    default:
+        parsed = 0;
+        break;
+    };
+
+    if(info)
+    {
+        if(parsed)
         {
-            if(nparsed)
-                memcpy(
-                parser->buffer,
-                parser->buffer + nparsed,
-                parser->buff_use -= nparsed);
-            break;
+            nmea_parser_pack2info(ptype, &node->data, info);
+            (*npack)++;
         }
-        else if(crc >= 0)
+    }
+    else if(!parsed)
+    {
+        if(node != &scratch)
+            nmea_parser_node_free(parser, node);
+    }
+    else
+    {
+        if(node == &scratch)
         {
-            ptype = nmea_pack_type(
-                (const char *)parser->buffer + nparsed + 1,
-                parser->buff_use - nparsed - 1);
+            node = nmea_parser_node_alloc(parser);
+            node->packType = ptype;
+            node->data = scratch.data;
+        }
+        if(parser->end_node)
+            ((nmeaParserNODE *)parser->end_node)->next_node = node;
+        parser->end_node = node;
+        if(!parser->top_node)
+            parser->top_node = node;
+        node->next_node = 0;
+    }
+}
 
-            if(0 == (node = malloc(sizeof(nmeaParserNODE))))
-                goto mem_fail;
+/**
+ * \brief Parse every whole sentence in the ring buffer
+ * @return Number of bytes parsed
+ */
+static int nmea_parser_ring_parse(nmeaPARSER *parser, nmeaINFO *info, int *npack)
+{
+    int nparsed = 0, crc, sen_sz, tail_sz;
+    const char *sen;
 
-            node->pack = 0;
+    while(parser->buff_use)
+    {
+        sen = (const char *)parser->buffer + parser->buff_head;
+        tail_sz = parser->buff_size - parser->buff_head;
 
-            switch(ptype)
-            {
-            case GPGGA:
-                if(0 == (node->pack = malloc(sizeof(nmeaGPGGA))))
-                    goto mem_fail;
-                node->packType = GPGGA;
-                if(!nmea_parse_GPGGA(
-                    (const char *)parser->buffer + nparsed,
-                    sen_sz, (nmeaGPGGA *)node->pack))
-                {
-                    free(node);
-                    node = 0;
-                }
-                break;
-            case GPGSA:
-                if(0 == (node->pack = malloc(sizeof(nmeaGPGSA))))
-                    goto mem_fail;
-                node->packType = GPGSA;
-                if(!nmea_parse_GPGSA(
-                    (const char *)parser->buffer + nparsed,
-                    sen_sz, (nmeaGPGSA *)node->pack))
-                {
-                    free(node);
-                    node = 0;
-                }
-                break;
-            case GPGSV:
-                if(0 == (node->pack = malloc(sizeof(nmeaGPGSV))))
-                    goto mem_fail;
-                node->packType = GPGSV;
-                if(!nmea_parse_GPGSV(
-                    (const char *)parser->buffer + nparsed,
-                    sen_sz, (nmeaGPGSV *)node->pack))
-                {
-                    free(node);
-                    node = 0;
-                }
-                break;
-            case GPRMC:
-                if(0 == (node->pack = malloc(sizeof(nmeaGPRMC))))
-                    goto mem_fail;
-                node->packType = GPRMC;
-                if(!nmea_parse_GPRMC(
-                    (const char *)parser->buffer + nparsed,
-                    sen_sz, (nmeaGPRMC *)node->pack))
-                {
-                    free(node);
-                    node = 0;
-                }
-                break;
-            case GPVTG:
-                if(0 == (node->pack = malloc(sizeof(nmeaGPVTG))))
-                    goto mem_fail;
-                node->packType = GPVTG;
-                if(!nmea_parse_GPVTG(
-                    (const char *)parser->buffer + nparsed,
-                    sen_sz, (nmeaGPVTG *)node->pack))
-                {
-                    free(node);
-                    node = 0;
-                }
-                break;
-            default:
-                free(node);
-                node = 0;
-                break;
-            };
-
-            if(node)
+        if(parser->buff_use <= tail_sz)
+            sen_sz = nmea_find_tail(sen, parser->buff_use, &crc);
+        else
+            sen_sz = nmea_find_tail_wrap(
+                sen, tail_sz,
+                (const char *)parser->buffer, parser->buff_use - tail_sz, &crc);
+
+        if(!sen_sz)
+            break;
+
+        if(crc >= 0)
+        {
+            if(sen_sz > tail_sz)
             {
-                if(parser->end_node)
-                    ((nmeaParserNODE *)parser->end_node)->next_node = node;
-                parser->end_node = node;
-                if(!parser->top_node)
-                    parser->top_node = node;
-                node->next_node = 0;
+                /* unwrap it behind the ring, the parsers want it in one piece */
+                unsigned char *line = parser->buffer + parser->buff_size;
+                memcpy(line, sen, tail_sz);
+                memcpy(line + tail_sz, parser->buffer, sen_sz - tail_sz);
+                sen = (const char *)line;
             }
+
+            nmea_parser_sentence(parser, sen, sen_sz, info, npack);
         }
 
+        parser->buff_head = (parser->buff_head + sen_sz) % parser->buff_size;
+        parser->buff_use -= sen_sz;
         nparsed += sen_sz;
     }
 
     return nparsed;
+}
 
-mem_fail:
-    if(node)
-        free(node);
+/**
+ * \brief Drop the oldest data of a full ring buffer that holds no sentence end,
+ * up to the next sentence start
+ */
+static void nmea_parser_ring_overflow(nmeaPARSER *parser)
+{
+    int drop;
 
-    nmea_error("Insufficient memory!");
+    for(drop = 1; drop < parser->buff_use; ++drop)
+    {
+        if('$' == parser->buffer[(parser->buff_head + drop) % parser->buff_size])
+            break;
+    }
+
+    parser->buff_head = (parser->buff_head + drop) % parser->buff_size;
+    parser->buff_use -= drop;
+    parser->buff_overflow++;
 
-    return -1;
+    nmea_error("Parse buffer overflow, %d bytes dropped!", drop);
 }
 
 /**
- * \brief Analysis of buffer and keep results into parser
- * @return Number of bytes wos parsed from buffer
+ * \brief Add the buffer to the ring and parse whole sentences as it fills.
+ * Packets are queued, or given to info and counted in npack if info is set.
+ * @return Number of bytes parsed
  */
-int nmea_parser_push(nmeaPARSER *parser, const char *buff, int buff_sz)
+static int nmea_parser_real_push(
+    nmeaPARSER *parser, const char *buff, int buff_sz,
+    nmeaINFO *info, int *npack)
 {
-    int nparse, nparsed = 0;
-
-    do
-    {
-        if(buff_sz > parser->buff_size)
-            nparse = parser->buff_size;
-        else
-            nparse = buff_sz;
+    int nparsed = 0, nadd, tail, part;
 
-        nparsed += nmea_parser_real_push(
-            parser, buff, nparse);
+    NMEA_ASSERT(parser && parser->buffer);
 
-        buff_sz -= nparse;
+    nmea_parser_release_pop(parser);
 
-    } while(buff_sz);
+    for(;;)
+    {
+        /* add what fits */
+        nadd = parser->buff_size - parser->buff_use;
+        if(nadd > buff_sz)
+            nadd = buff_sz;
+
+        tail = (parser->buff_head + parser->buff_use) % parser->buff_size;
+        part = parser->buff_size - tail;
+        if(part > nadd)
+            part = nadd;
+
+        memcpy(parser->buffer + tail, buff, part);
+        memcpy(parser->buffer, buff + part, nadd - part);
+        parser->buff_use += nadd;
+        buff += nadd;
+        buff_sz -= nadd;
+
+        /* parse */
+        nparsed += nmea_parser_ring_parse(parser, info, npack);
+
+        if(parser->buff_use == parser->buff_size)
+            nmea_parser_ring_overflow(parser);
+        else if(!buff_sz)
+            break;
+    }
 
     return nparsed;
 }
 
+/**
+ * \brief Analysis of buffer and keep results into parser
+ * @return Number of bytes wos parsed from buffer
+ */
+int nmea_parser_push(nmeaPARSER *parser, const char *buff, int buff_sz)
+{
+    return nmea_parser_real_push(parser, buff, buff_sz, 0, 0);
+}
+
 /**
  * \brief Get type of top packet keeped into parser
  * @return Type of packet
@@ -306,7 +411,9 @@ int nmea_parser_top(nmeaPARSER *parser)
 }
 
 /**
- * \brief Withdraw top packet from parser
+ * \brief Withdraw top packet from parser.
+ * The packet belongs to the parser and stays valid until the next call
+ * of push, pop, drop or clear on it; it must not be freed.
  * @return Received packet type
  * @see nmeaPACKTYPE
  */
@@ -317,14 +424,16 @@ int nmea_parser_pop(nmeaPARSER *parser, void **pack_ptr)
 
     NMEA_ASSERT(parser && parser->buffer);
 
+    nmea_parser_release_pop(parser);
+
     if(node)
     {
-        *pack_ptr = node->pack;
+        *pack_ptr = &node->data;
         retval = node->packType;
         parser->top_node = node->next_node;
         if(!parser->top_node)
             parser->end_node = 0;
-        free(node);
+        parser->pop_node = node;
     }
 
     return retval;
@@ -344,7 +453,7 @@ int nmea_parser_peek(nmeaPARSER *parser, void **pack_ptr)
 
     if(node)
     {
-        *pack_ptr = node->pack;
+        *pack_ptr = &node->data;
         retval = node->packType;
     }
 
@@ -363,15 +472,15 @@ int nmea_parser_drop(nmeaPARSER *parser)
 
     NMEA_ASSERT(parser && parser->buffer);
 
+    nmea_parser_release_pop(parser);
+
     if(node)
     {
-        if(node->pack)
-            free(node->pack);
         retval = node->packType;
         parser->top_node = node->next_node;
         if(!parser->top_node)
             parser->end_node = 0;
-        free(node);
+        nmea_parser_node_free(parser, node);
     }
 
     return retval;
@@ -385,6 +494,7 @@ int nmea_parser_buff_clear(nmeaPARSER *parser)
 {
     NMEA_ASSERT(parser && parser->buffer);
     parser->buff_use = 0;
+    parser->buff_head = 0;
     return 1;
 }
 
@@ -395,6 +505,7 @@ int nmea_parser_buff_clear(nmeaPARSER *parser)
 int nmea_parser_queue_clear(nmeaPARSER *parser)
 {
     NMEA_ASSERT(parser);
+    nmea_parser_release_pop(parser);
     while(parser->top_node)
         nmea_parser_drop(parser);
     return 1;
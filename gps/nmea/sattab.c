@@ -0,0 +1,246 @@
+/*
+ *
+ * NMEA library
+ * URL: http://nmea.sourceforge.net
+ * Author: Tim (xtimor@gmail.com)
+ * Licence: http://www.gnu.org/licenses/lgpl.html
+ *
+ */
+
+/**
+ * \file sattab.h
+ * \brief Satellites in view of several systems.
+ *
+ * Every talker reports its satellites in a GSV set of up to NMEA_MAXGSV
+ * messages, a GN set may mix systems. A new set of a talker replaces the
+ * entries of that talker and leaves the others. Nothing is allocated
+ * after nmea_sattab_init.
+ */
+
+#include "nmea/sattab.h"
+#include "nmea/context.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* First PRN of each system, bit 0 of its used mask */
+static const int nmea_sys_prn[NMEA_NSYS] = { 1, 65, 1 };
+
+/**
+ * \brief Allocate the columns of a table of capacity entries.
+ * @return 1 (true) - if allocated or 0 (false) - if fail.
+ */
+int nmea_sattab_init(nmeaSATTAB *tab, int capacity)
+{
+    char *cols;
+
+    NMEA_ASSERT(tab && capacity > 0);
+
+    memset(tab, 0, sizeof(nmeaSATTAB));
+
+    if(0 == (cols = malloc(capacity * (4 * sizeof(short) + 2))))
+    {
+        nmea_error("Insufficient memory!");
+        return 0;
+    }
+
+    tab->capacity = capacity;
+    tab->prn = (short *)cols;
+    tab->elv = tab->prn + capacity;
+    tab->azimuth = tab->elv + capacity;
+    tab->sig = tab->azimuth + capacity;
+    tab->sys = (unsigned char *)(tab->sig + capacity);
+    tab->set = tab->sys + capacity;
+
+    return 1;
+}
+
+/**
+ * \brief Free the columns of a table
+ */
+void nmea_sattab_destroy(nmeaSATTAB *tab)
+{
+    NMEA_ASSERT(tab);
+    free(tab->prn);
+    memset(tab, 0, sizeof(nmeaSATTAB));
+}
+
+/**
+ * \brief Drop all satellites, used masks, partial GSV sets and their reset count
+ */
+void nmea_sattab_clear(nmeaSATTAB *tab)
+{
+    NMEA_ASSERT(tab);
+    tab->count = 0;
+    tab->gsv_resets = 0;
+    memset(&tab->used[0], 0, sizeof(tab->used));
+    memset(&tab->gsv_count[0], 0, sizeof(tab->gsv_count));
+    memset(&tab->gsv_mask[0], 0, sizeof(tab->gsv_mask));
+}
+
+/**
+ * \brief Drop the used in fix masks of all systems (before a new round of GSA)
+ */
+void nmea_sattab_clear_used(nmeaSATTAB *tab)
+{
+    NMEA_ASSERT(tab);
+    memset(&tab->used[0], 0, sizeof(tab->used));
+}
+
+/**
+ * \brief System of a satellite (nmeaSYSTEM).
+ * GN packets mix systems, their GLONASS satellites are told apart by PRN.
+ * @param talker talker of the packet (nmeaTALKER).
+ * @param prn satellite PRN number.
+ */
+int nmea_sattab_system(int talker, int prn)
+{
+    switch(talker)
+    {
+    case NMEA_TALKER_GL:
+        return NMEA_SYS_GLONASS;
+    case NMEA_TALKER_GA:
+        return NMEA_SYS_GALILEO;
+    case NMEA_TALKER_GP:
+        return NMEA_SYS_GPS;
+    }
+
+    return (prn >= 65 && prn <= 96) ? NMEA_SYS_GLONASS : NMEA_SYS_GPS;
+}
+
+/**
+ * \brief Bit of a satellite in the used mask of its system, -1 if none
+ */
+static int _nmea_sattab_bit(int sys, int prn)
+{
+    int bit = prn - nmea_sys_prn[sys];
+
+    return (bit >= 0 && bit < (int)sizeof(unsigned long long) * 8) ? bit : -1;
+}
+
+/**
+ * \brief Drop the entries of the set of one talker, keeping the order of the others
+ */
+static void _nmea_sattab_drop(nmeaSATTAB *tab, int set)
+{
+    int it, nkeep = 0;
+
+    for(it = 0; it < tab->count; ++it)
+    {
+        if(tab->set[it] == set)
+            continue;
+        if(nkeep != it)
+        {
+            tab->prn[nkeep] = tab->prn[it];
+            tab->elv[nkeep] = tab->elv[it];
+            tab->azimuth[nkeep] = tab->azimuth[it];
+            tab->sig[nkeep] = tab->sig[it];
+            tab->sys[nkeep] = tab->sys[it];
+            tab->set[nkeep] = tab->set[it];
+        }
+        nkeep++;
+    }
+
+    tab->count = nkeep;
+}
+
+/**
+ * \brief Add a GSV message to the set of its talker.
+ * The first message of a set, or one the set already has, starts the
+ * set over, counted in gsv_resets if the set was not complete.
+ * Satellites past the capacity of the table are dropped.
+ * @param tab a pointer of table structure.
+ * @param talker talker of the packet (nmeaTALKER).
+ * @param pack a pointer of packet structure.
+ * @return Systems whose satellites the message completed, bit nmeaSYSTEM,
+ * or 0. A complete set without satellites reports the system of its talker.
+ */
+int nmea_sattab_GSV(nmeaSATTAB *tab, int talker, const nmeaGPGSV *pack)
+{
+    int set, bit, isat, nsat, it, systems = 0;
+
+    NMEA_ASSERT(tab && pack);
+
+    if(pack->pack_count < 1 || pack->pack_count > NMEA_MAXGSV ||
+        pack->pack_index < 1 || pack->pack_index > pack->pack_count)
+        return 0;
+
+    set = (talker >= 0 && talker < NMEA_NGSVSET) ? talker : NMEA_TALKER_NON;
+    bit = 1 << (pack->pack_index - 1);
+
+    if(1 == pack->pack_index || pack->pack_count != tab->gsv_count[set] ||
+        (tab->gsv_mask[set] & bit))
+    {
+        if(tab->gsv_mask[set] != 0 && tab->gsv_mask[set] != (1 << tab->gsv_count[set]) - 1)
+            tab->gsv_resets++;
+        _nmea_sattab_drop(tab, set);
+        tab->gsv_count[set] = pack->pack_count;
+        tab->gsv_mask[set] = 0;
+    }
+    tab->gsv_mask[set] |= bit;
+
+    nsat = pack->sat_count - (pack->pack_index - 1) * NMEA_SATINPACK;
+    if(nsat > NMEA_SATINPACK)
+        nsat = NMEA_SATINPACK;
+
+    for(isat = 0; isat < nsat && tab->count < tab->capacity; ++isat)
+    {
+        tab->prn[tab->count] = (short)pack->sat_data[isat].id;
+        tab->elv[tab->count] = (short)pack->sat_data[isat].elv;
+        tab->azimuth[tab->count] = (short)pack->sat_data[isat].azimuth;
+        tab->sig[tab->count] = (short)pack->sat_data[isat].sig;
+        tab->sys[tab->count] = (unsigned char)nmea_sattab_system(talker, pack->sat_data[isat].id);
+        tab->set[tab->count] = (unsigned char)set;
+        tab->count++;
+    }
+
+    if(tab->gsv_mask[set] != (1 << tab->gsv_count[set]) - 1)
+        return 0;
+
+    for(it = 0; it < tab->count; ++it)
+    {
+        if(tab->set[it] == set)
+            systems |= 1 << tab->sys[it];
+    }
+
+    return systems ? systems : 1 << nmea_sattab_system(talker, 0);
+}
+
+/**
+ * \brief Mark the satellites of a GSA packet used in fix.
+ * The masks add up until nmea_sattab_clear_used, as GN receivers send
+ * one GSA per system.
+ * @param tab a pointer of table structure.
+ * @param talker talker of the packet (nmeaTALKER).
+ * @param pack a pointer of packet structure.
+ */
+void nmea_sattab_GSA(nmeaSATTAB *tab, int talker, const nmeaGPGSA *pack)
+{
+    int it, sys, bit;
+
+    NMEA_ASSERT(tab && pack);
+
+    for(it = 0; it < NMEA_MAXSAT; ++it)
+    {
+        if(pack->sat_prn[it] <= 0)
+            continue;
+        sys = nmea_sattab_system(talker, pack->sat_prn[it]);
+        bit = _nmea_sattab_bit(sys, pack->sat_prn[it]);
+        if(bit >= 0)
+            tab->used[sys] |= 1ULL << bit;
+    }
+}
+
+/**
+ * \brief Is entry idx of the table used in fix
+ */
+int nmea_sattab_in_use(const nmeaSATTAB *tab, int idx)
+{
+    int bit;
+
+    NMEA_ASSERT(tab && idx >= 0 && idx < tab->count);
+
+    bit = _nmea_sattab_bit(tab->sys[idx], tab->prn[idx]);
+
+    return (bit >= 0 && (tab->used[tab->sys[idx]] >> bit) & 1);
+}
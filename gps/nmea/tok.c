@@ -11,6 +11,7 @@
 /*! \file tok.h */
 
 #include "nmea/tok.h"
+#include "nmea/gmath.h"
 
 #include <stdarg.h>
 #include <stdlib.h>
@@ -24,6 +25,15 @@
 #define NMEA_TOKS_WIDTH     (3)
 #define NMEA_TOKS_TYPE      (4)
 
+/* Powers of ten that are exact in a double */
+static const double nmea_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define NMEA_POW10_MAX      ((int)(sizeof(nmea_pow10) / sizeof(nmea_pow10[0])) - 1)
+
 /**
  * \brief Calculate control sum of binary buffer
  */
@@ -76,6 +86,181 @@ double nmea_atof(const char *str, int str_sz)
     return res;
 }
 
+/**
+ * \brief Convert decimal string to number without copying it.
+ * Same result as nmea_atoi(str, str_sz, 10).
+ */
+int nmea_fixtoi(const char *str, int str_sz)
+{
+    const char *end = str + str_sz;
+    const char *digits;
+    int neg = 0, res = 0;
+
+    while(str < end && isspace((unsigned char)*str))
+        ++str;
+    if(str < end && ('-' == *str || '+' == *str))
+        neg = ('-' == *str++);
+
+    for(digits = str; str < end && *str >= '0' && *str <= '9'; ++str)
+    {
+        /* Leave overflow to strtol */
+        if(str - digits == 9)
+            return nmea_atoi(end - str_sz, str_sz, 10);
+        res = res * 10 + (*str - '0');
+    }
+
+    return neg ? -res : res;
+}
+
+/**
+ * \brief Convert decimal fraction string to number without copying it.
+ * Same result as nmea_atof(str, str_sz): a mantissa below 2^53 divided by
+ * an exact power of ten is correctly rounded, as strtod is. Anything else
+ * (exponents, long mantissas, trailing text) goes to nmea_atof.
+ */
+double nmea_fixtof(const char *str, int str_sz)
+{
+    const char *end = str + str_sz;
+    const char *point = 0;
+    int neg = 0, ndigit = 0, nfrac = 0;
+    unsigned long long mant = 0;
+    double res;
+
+    if(!str_sz)
+        return 0;
+
+    while(str < end && isspace((unsigned char)*str))
+        ++str;
+    if(str < end && ('-' == *str || '+' == *str))
+        neg = ('-' == *str++);
+
+    for(; str < end; ++str)
+    {
+        if(*str >= '0' && *str <= '9')
+        {
+            mant = mant * 10 + (*str - '0');
+            ndigit++;
+            if(point)
+                nfrac++;
+        }
+        else if('.' == *str && !point)
+            point = str;
+        else
+            break;
+    }
+
+    if(str < end || !ndigit || ndigit > 17 ||
+        nfrac > NMEA_POW10_MAX || mant >= (1ULL << 53))
+        return nmea_atof(end - str_sz, str_sz);
+
+    res = (double)mant / nmea_pow10[nfrac];
+
+    return neg ? -res : res;
+}
+
+/**
+ * \brief Convert NDEG string ([degree][min].[min fraction]) to nano-degrees.
+ * Degrees and minutes are taken apart as integers, so the result is the
+ * text rounded to the nearest nano-degree (minute digits past the ninth are
+ * cut). *ndeg gets the NDEG value of the string, as nmea_fixtof gives it.
+ * Anything else than digits and one point goes to nmea_atof.
+ */
+long long nmea_fixtonano(const char *str, int str_sz, double *ndeg)
+{
+    const char *end = str + str_sz;
+    const char *point = 0;
+    int neg = 0, ndigit = 0, nfrac = 0;
+    unsigned long long mant = 0, ipart = 0, frac = 0;
+    long long res;
+
+    *ndeg = 0;
+    if(!str_sz)
+        return 0;
+
+    while(str < end && isspace((unsigned char)*str))
+        ++str;
+    if(str < end && ('-' == *str || '+' == *str))
+        neg = ('-' == *str++);
+
+    for(; str < end; ++str)
+    {
+        if(*str >= '0' && *str <= '9')
+        {
+            mant = mant * 10 + (*str - '0');
+            ndigit++;
+            if(!point)
+                ipart = mant;
+            else if(++nfrac <= 9)
+                frac = frac * 10 + (*str - '0');
+        }
+        else if('.' == *str && !point)
+            point = str;
+        else
+            break;
+    }
+
+    if(str < end || !ndigit || ndigit > 17 || nfrac > NMEA_POW10_MAX ||
+        mant >= (1ULL << 53) || ipart >= NMEA_NDEG_NANO_MAX)
+    {
+        *ndeg = nmea_atof(end - str_sz, str_sz);
+        return nmea_ndeg2nano(*ndeg);
+    }
+
+    *ndeg = (double)mant / nmea_pow10[nfrac];
+    if(neg)
+        *ndeg = -*ndeg;
+
+    /* Minutes in 1e-9, a nano-degree is 60 of them */
+    for(; nfrac < 9; ++nfrac)
+        frac *= 10;
+    res = (long long)(ipart / 100) * 1000000000LL +
+        (long long)(((ipart % 100) * 1000000000ULL + frac + 30) / 60);
+
+    return neg ? -res : res;
+}
+
+/**
+ * \brief Find the field offsets of a sentence in one pass.
+ * Field 0 is the header, the last field ends at the '*'.
+ * @return Number of fields or -1 if there is no '*', a ',' follows the
+ * '*' or there are more than NMEA_MAXFIELDS fields.
+ */
+int nmea_split(const char *buff, int buff_sz, nmeaFIELDS *fields)
+{
+    const char *it = buff;
+    const char *end_buf = buff + buff_sz;
+    int count = 0;
+
+    NMEA_ASSERT(buff && fields);
+
+    fields->buff = buff;
+    fields->wide = 0;
+    fields->beg[0] = 0;
+
+    for(; it < end_buf; ++it)
+    {
+        if(',' != *it && '*' != *it)
+            continue;
+
+        if(count == NMEA_MAXFIELDS)
+            return -1;
+
+        fields->beg[++count] = (int)(it - buff) + 1;
+        if(fields->beg[count] - fields->beg[count - 1] > 2)
+            fields->wide |= 1 << (count - 1);
+
+        if('*' == *it)
+            break;
+    }
+
+    if(it == end_buf || memchr(it, ',', end_buf - it))
+        return -1;
+
+    fields->count = count;
+
+    return count;
+}
+
 /**
  * \brief Formating string (like standart printf) with CRC tail (*CRC)
  */
@@ -0,0 +1,558 @@
+/*
+ * NMEA library parse benchmark (host tool)
+ *
+ * Parses one receiver epoch repeatedly, once with the nmea_scanf formats
+ * the library used before the direct field parsers, and once with
+ * nmea_parse_GPxxx. Prints sentences/sec for both and fails if the
+ * resulting nmeaINFO differ.
+ *
+ * Then frames the same sentences (checksum and packet type) with the
+ * bytewise nmea_find_tail and memcmp header lookup the library used
+ * before, and with the current ones, and fails if they disagree. The two
+ * take turns for BENCH_ROUNDS rounds, the best round of each counts.
+ *
+ * Last, random positions go through nmea_generate and nmea_parse_GPxxx,
+ * and through hand made GGA with 4 - 9 minute decimals. The nano-degrees
+ * parsed have to be the text rounded to the nearest, and the NDEG the same
+ * nmea_fixtof gives. The error of the NDEG double -> degrees conversion the
+ * HAL used before is printed next to it.
+ *
+ * GGA times with 0 - 3 fraction digits have to give the fraction in
+ * hundredths of a second.
+ *
+ * Usage: nmea_bench [epochs]
+ */
+
+#include "nmea/nmea/nmea.h"
+#include "nmea/nmea/tok.h"
+#include "nmea/nmea/gmath.h"
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_EPOCHS    (200000)
+#define BENCH_COORDS    (100000)
+#define BENCH_ROUNDS    (10)
+
+static const char *epoch[] = {
+    "$GPGGA,123519.00,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*69\r\n",
+    "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\r\n",
+    "$GPGSV,3,1,09,01,40,083,46,02,17,308,41,12,07,344,39,14,22,228,45*75\r\n",
+    "$GPGSV,3,2,09,15,40,083,46,16,17,308,41,17,07,344,39,18,22,228,45*7F\r\n",
+    "$GPGSV,3,3,09,19,40,083,46*45\r\n",
+    "$GPRMC,123519.00,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W,A*29\r\n",
+    "$GPVTG,084.4,T,081.3,M,022.4,N,041.5,K*48\r\n",
+};
+
+#define EPOCH_SIZE      ((int)(sizeof(epoch) / sizeof(epoch[0])))
+
+static int epoch_len[EPOCH_SIZE];
+
+typedef int (*benchParse)(const char *buff, int buff_sz, int type, nmeaINFO *info);
+
+static void quiet(const char *str, int str_size)
+{
+}
+
+/* The packet parsers as they were, on top of nmea_scanf */
+static int scanf_time(const char *buff, nmeaTIME *res)
+{
+    switch(strlen(buff))
+    {
+    case sizeof("hhmmss") - 1:
+        return (3 == nmea_scanf(buff, 6, "%2d%2d%2d", &(res->hour), &(res->min), &(res->sec)));
+    case sizeof("hhmmss.s") - 1:
+    case sizeof("hhmmss.ss") - 1:
+    case sizeof("hhmmss.sss") - 1:
+        return (4 == nmea_scanf(buff, (int)strlen(buff), "%2d%2d%2d.%d",
+            &(res->hour), &(res->min), &(res->sec), &(res->hsec)));
+    }
+    return 0;
+}
+
+static int parse_scanf(const char *buff, int buff_sz, int type, nmeaINFO *info)
+{
+    char time_buff[NMEA_TIMEPARSE_BUF];
+    union {
+        nmeaGPGGA gga;
+        nmeaGPGSA gsa;
+        nmeaGPGSV gsv;
+        nmeaGPRMC rmc;
+        nmeaGPVTG vtg;
+    } pack;
+    int nsen;
+
+    memset(&pack, 0, sizeof(pack));
+    time_buff[0] = '\0';
+
+    switch(type)
+    {
+    case GPGGA:
+        if(14 != nmea_scanf(buff, buff_sz,
+            "$GPGGA,%s,%f,%C,%f,%C,%d,%d,%f,%f,%C,%f,%C,%f,%d*",
+            &(time_buff[0]),
+            &(pack.gga.lat), &(pack.gga.ns), &(pack.gga.lon), &(pack.gga.ew),
+            &(pack.gga.sig), &(pack.gga.satinuse), &(pack.gga.HDOP), &(pack.gga.elv), &(pack.gga.elv_units),
+            &(pack.gga.diff), &(pack.gga.diff_units), &(pack.gga.dgps_age), &(pack.gga.dgps_sid)) ||
+            !scanf_time(time_buff, &(pack.gga.utc)))
+            return 0;
+        nmea_GPGGA2info(&pack.gga, info);
+        break;
+    case GPGSA:
+        if(17 != nmea_scanf(buff, buff_sz,
+            "$GPGSA,%C,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f*",
+            &(pack.gsa.fix_mode), &(pack.gsa.fix_type),
+            &(pack.gsa.sat_prn[0]), &(pack.gsa.sat_prn[1]), &(pack.gsa.sat_prn[2]), &(pack.gsa.sat_prn[3]),
+            &(pack.gsa.sat_prn[4]), &(pack.gsa.sat_prn[5]), &(pack.gsa.sat_prn[6]), &(pack.gsa.sat_prn[7]),
+            &(pack.gsa.sat_prn[8]), &(pack.gsa.sat_prn[9]), &(pack.gsa.sat_prn[10]), &(pack.gsa.sat_prn[11]),
+            &(pack.gsa.PDOP), &(pack.gsa.HDOP), &(pack.gsa.VDOP)))
+            return 0;
+        nmea_GPGSA2info(&pack.gsa, info);
+        break;
+    case GPGSV:
+        nsen = nmea_scanf(buff, buff_sz,
+            "$GPGSV,%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d,"
+            "%d,%d,%d,%d*",
+            &(pack.gsv.pack_count), &(pack.gsv.pack_index), &(pack.gsv.sat_count),
+            &(pack.gsv.sat_data[0].id), &(pack.gsv.sat_data[0].elv), &(pack.gsv.sat_data[0].azimuth), &(pack.gsv.sat_data[0].sig),
+            &(pack.gsv.sat_data[1].id), &(pack.gsv.sat_data[1].elv), &(pack.gsv.sat_data[1].azimuth), &(pack.gsv.sat_data[1].sig),
+            &(pack.gsv.sat_data[2].id), &(pack.gsv.sat_data[2].elv), &(pack.gsv.sat_data[2].azimuth), &(pack.gsv.sat_data[2].sig),
+            &(pack.gsv.sat_data[3].id), &(pack.gsv.sat_data[3].elv), &(pack.gsv.sat_data[3].azimuth), &(pack.gsv.sat_data[3].sig));
+        if(nsen < 3)
+            return 0;
+        nmea_GPGSV2info(&pack.gsv, info);
+        break;
+    case GPRMC:
+        nsen = nmea_scanf(buff, buff_sz,
+            "$GPRMC,%s,%C,%f,%C,%f,%C,%f,%f,%2d%2d%2d,%f,%C,%C*",
+            &(time_buff[0]),
+            &(pack.rmc.status), &(pack.rmc.lat), &(pack.rmc.ns), &(pack.rmc.lon), &(pack.rmc.ew),
+            &(pack.rmc.speed), &(pack.rmc.direction),
+            &(pack.rmc.utc.day), &(pack.rmc.utc.mon), &(pack.rmc.utc.year),
+            &(pack.rmc.declination), &(pack.rmc.declin_ew), &(pack.rmc.mode));
+        if((nsen != 13 && nsen != 14) || !scanf_time(time_buff, &(pack.rmc.utc)))
+            return 0;
+        if(pack.rmc.utc.year < 90)
+            pack.rmc.utc.year += 100;
+        pack.rmc.utc.mon -= 1;
+        nmea_GPRMC2info(&pack.rmc, info);
+        break;
+    case GPVTG:
+        if(8 != nmea_scanf(buff, buff_sz,
+            "$GPVTG,%f,%C,%f,%C,%f,%C,%f,%C*",
+            &(pack.vtg.dir), &(pack.vtg.dir_t), &(pack.vtg.dec), &(pack.vtg.dec_m),
+            &(pack.vtg.spn), &(pack.vtg.spn_n), &(pack.vtg.spk), &(pack.vtg.spk_k)))
+            return 0;
+        nmea_GPVTG2info(&pack.vtg, info);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parse_fields(const char *buff, int buff_sz, int type, nmeaINFO *info)
+{
+    union {
+        nmeaGPGGA gga;
+        nmeaGPGSA gsa;
+        nmeaGPGSV gsv;
+        nmeaGPRMC rmc;
+        nmeaGPVTG vtg;
+    } pack;
+
+    switch(type)
+    {
+    case GPGGA:
+        if(!nmea_parse_GPGGA(buff, buff_sz, &pack.gga))
+            return 0;
+        nmea_GPGGA2info(&pack.gga, info);
+        break;
+    case GPGSA:
+        if(!nmea_parse_GPGSA(buff, buff_sz, &pack.gsa))
+            return 0;
+        nmea_GPGSA2info(&pack.gsa, info);
+        break;
+    case GPGSV:
+        if(!nmea_parse_GPGSV(buff, buff_sz, &pack.gsv))
+            return 0;
+        nmea_GPGSV2info(&pack.gsv, info);
+        break;
+    case GPRMC:
+        if(!nmea_parse_GPRMC(buff, buff_sz, &pack.rmc))
+            return 0;
+        nmea_GPRMC2info(&pack.rmc, info);
+        break;
+    case GPVTG:
+        if(!nmea_parse_GPVTG(buff, buff_sz, &pack.vtg))
+            return 0;
+        nmea_GPVTG2info(&pack.vtg, info);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Sentence framing as it was, a byte at a time */
+static int bytewise_find_tail(const char *buff, int buff_sz, int *res_crc)
+{
+    static const int tail_sz = 3 /* *[CRC] */ + 2 /* \r\n */;
+
+    const char *end_buff = buff + buff_sz;
+    int nread = 0;
+    int crc = 0;
+
+    *res_crc = -1;
+
+    for(;buff < end_buff; ++buff, ++nread)
+    {
+        if(('$' == *buff) && nread)
+        {
+            buff = 0;
+            break;
+        }
+        else if('*' == *buff)
+        {
+            if(buff + tail_sz <= end_buff && '\r' == buff[3] && '\n' == buff[4])
+            {
+                *res_crc = nmea_atoi(buff + 1, 2, 16);
+                nread = buff_sz - (int)(end_buff - (buff + tail_sz));
+                if(*res_crc != crc)
+                {
+                    *res_crc = -1;
+                    buff = 0;
+                }
+            }
+
+            break;
+        }
+        else if(nread)
+            crc ^= (int)*buff;
+    }
+
+    if(*res_crc < 0 && buff)
+        nread = 0;
+
+    return nread;
+}
+
+static int memcmp_pack_type(const char *buff, int buff_sz)
+{
+    static const char *pheads[] = {
+        "GPGGA",
+        "GPGSA",
+        "GPGSV",
+        "GPRMC",
+        "GPVTG",
+    };
+
+    if(buff_sz < 5)
+        return GPNON;
+    else if(0 == memcmp(buff, pheads[0], 5))
+        return GPGGA;
+    else if(0 == memcmp(buff, pheads[1], 5))
+        return GPGSA;
+    else if(0 == memcmp(buff, pheads[2], 5))
+        return GPGSV;
+    else if(0 == memcmp(buff, pheads[3], 5))
+        return GPRMC;
+    else if(0 == memcmp(buff, pheads[4], 5))
+        return GPVTG;
+
+    return GPNON;
+}
+
+typedef int (*benchTail)(const char *buff, int buff_sz, int *res_crc);
+typedef int (*benchType)(const char *buff, int buff_sz);
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns sentences/sec, or -1 if a sentence failed to parse */
+static double run(benchParse parse, int epochs, nmeaINFO *info)
+{
+    double start;
+    int i, it;
+
+    nmea_zero_INFO(info);
+    start = now();
+
+    for(it = 0; it < epochs; ++it)
+    {
+        for(i = 0; i < EPOCH_SIZE; ++i)
+        {
+            if(!parse(epoch[i], epoch_len[i], nmea_pack_type(epoch[i] + 1, epoch_len[i] - 1), info))
+                return -1;
+        }
+    }
+
+    return (double)epochs * EPOCH_SIZE / (now() - start);
+}
+
+/* Returns sentences/sec and a sum of the framing results in *check */
+static double frame(benchTail find_tail, benchType pack_type, int epochs, long *check)
+{
+    double start;
+    int i, it, crc, len;
+    long sum = 0;
+
+    start = now();
+
+    for(it = 0; it < epochs; ++it)
+    {
+        for(i = 0; i < EPOCH_SIZE; ++i)
+        {
+            len = find_tail(epoch[i], epoch_len[i], &crc);
+            if(len > 0)
+                sum += len + crc + pack_type(epoch[i] + 1, len - 1);
+        }
+    }
+
+    *check = sum;
+
+    return (double)epochs * EPOCH_SIZE / (now() - start);
+}
+
+/* NDEG -> degrees as the HAL did it before the nano-degrees */
+static double convert_coord(double coord)
+{
+    double degrees;
+    double mins = modf(coord/100.0f, &degrees);
+    degrees += mins*100.0/60.0f;
+    return degrees;
+}
+
+/* Nano-degrees of field idx with the hemisphere of field idx + 1, unrounded */
+static long double text_nano(const nmeaFIELDS *f, int idx)
+{
+    char field[NMEA_CONVSTR_BUF];
+    long double ndeg, deg;
+    int len = nmea_field_len(f, idx);
+
+    memcpy(field, f->buff + f->beg[idx], len);
+    field[len] = '\0';
+    ndeg = strtold(field, 0);
+    deg = floorl(ndeg / 100);
+    ndeg = deg * 1e9L + (ndeg - deg * 100) * 1e9L / 60;
+
+    return (nmea_field_char(f, idx + 1) == 'N' || nmea_field_char(f, idx + 1) == 'E') ? ndeg : -ndeg;
+}
+
+/* Checks a parsed coordinate against field idx, returns 0 if it is off */
+static int check_coord(const nmeaFIELDS *f, int idx, long long nano, double ndeg,
+    double *old_err)
+{
+    long double exact = text_nano(f, idx);
+    double err, old;
+
+    if(ndeg != nmea_fixtof(f->buff + f->beg[idx], nmea_field_len(f, idx)))
+        return 0;
+    err = fabs((double)(nano - exact));
+    if(err > 0.5 + 1e-6)
+        return 0;
+
+    old = convert_coord(nmea_field_char(f, idx + 1) == 'N' || nmea_field_char(f, idx + 1) == 'E' ? ndeg : -ndeg);
+    err = fabs((double)(old * 1e9L - exact));
+    if(err > *old_err)
+        *old_err = err;
+
+    return 1;
+}
+
+static int check_sentence(const char *buff, int buff_sz, double *old_err)
+{
+    nmeaFIELDS f;
+    nmeaGPGGA gga;
+    nmeaGPRMC rmc;
+    int crc;
+
+    if(nmea_find_tail(buff, buff_sz, &crc) != buff_sz || crc < 0 ||
+        nmea_split(buff, buff_sz, &f) < 0)
+        return 0;
+
+    switch(nmea_pack_type(buff + 1, buff_sz - 1))
+    {
+    case GPGGA:
+        return nmea_parse_GPGGA(buff, buff_sz, &gga) &&
+            check_coord(&f, 2, gga.lat_nano, gga.lat, old_err) &&
+            check_coord(&f, 4, gga.lon_nano, gga.lon, old_err);
+    case GPRMC:
+        return nmea_parse_GPRMC(buff, buff_sz, &rmc) &&
+            check_coord(&f, 3, rmc.lat_nano, rmc.lat, old_err) &&
+            check_coord(&f, 5, rmc.lon_nano, rmc.lon, old_err);
+    }
+
+    return 0;
+}
+
+static double random_ndeg(int max_deg)
+{
+    double ndeg = (rand() % max_deg) * 100 + rand() / (RAND_MAX + 1.0) * 60;
+    return (rand() & 1) ? ndeg : -ndeg;
+}
+
+/*
+ * Round trips count random positions, returns 0 if one is parsed wrong.
+ * *old_err gets the largest error of convert_coord in nano-degrees.
+ */
+static int coords(int count, double *old_err)
+{
+    char buff[NMEA_MAXSAT * NMEA_CONVSTR_BUF];
+    nmeaINFO info;
+    double lat, lon;
+    const char *it, *end;
+    int i, len, digits;
+
+    srand(1);
+    *old_err = 0;
+
+    for(i = 0; i < count; ++i)
+    {
+        nmea_zero_INFO(&info);
+        info.sig = NMEA_SIG_LOW;
+        info.lat = random_ndeg(90);
+        info.lon = random_ndeg(180);
+
+        len = nmea_generate(buff, sizeof(buff), &info, GPGGA | GPRMC);
+        for(it = buff, end = buff + len; it < end; it += len)
+        {
+            len = (int)(strchr(it, '\n') + 1 - it);
+            if(!check_sentence(it, len, old_err))
+                return 0;
+        }
+
+        /* The generator prints 4 decimals, receivers up to 9 */
+        digits = 4 + i % 6;
+        lat = random_ndeg(90);
+        lon = random_ndeg(180);
+        len = nmea_printf(buff, sizeof(buff),
+            "$GPGGA,123519.00,%0*.*f,%c,%0*.*f,%c,1,08,0.9,545.4,M,46.9,M,,",
+            digits + 5, digits, fabs(lat), (lat < 0) ? 'S' : 'N',
+            digits + 6, digits, fabs(lon), (lon < 0) ? 'W' : 'E');
+        if(!check_sentence(buff, len, old_err))
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Parses GGA times with 0 - 3 fraction digits, returns 0 if one is wrong */
+static int times(void)
+{
+    static const struct {
+        const char *time;
+        int hsec;
+    } cases[] = {
+        { "123519", 0 },
+        { "123519.5", 50 },
+        { "123519.05", 5 },
+        { "123519.50", 50 },
+        { "123519.123", 12 },
+        { "123519.999", 99 },
+    };
+    char buff[NMEA_MAXSAT * NMEA_CONVSTR_BUF];
+    nmeaGPGGA gga;
+    int i, len;
+
+    for(i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); ++i)
+    {
+        len = nmea_printf(buff, sizeof(buff),
+            "$GPGGA,%s,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,", cases[i].time);
+        if(!nmea_parse_GPGGA(buff, len, &gga) || gga.utc.sec != 19 || gga.utc.hsec != cases[i].hsec)
+        {
+            fprintf(stderr, "nmea_bench: time %s parsed as %d.%02d\n",
+                cases[i].time, gga.utc.sec, gga.utc.hsec);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    nmeaINFO before, after;
+    double rate_before, rate_after, rate;
+    long check_before, check_after;
+    double old_err;
+    int epochs = (argc > 1) ? atoi(argv[1]) : BENCH_EPOCHS;
+    int i;
+
+    nmea_property()->trace_func = &quiet;
+    nmea_property()->error_func = &quiet;
+
+    for(i = 0; i < EPOCH_SIZE; ++i)
+        epoch_len[i] = (int)strlen(epoch[i]);
+
+    rate_before = run(&parse_scanf, epochs, &before);
+    rate_after = run(&parse_fields, epochs, &after);
+
+    if(rate_before < 0 || rate_after < 0)
+    {
+        fprintf(stderr, "nmea_bench: parse failed\n");
+        return 1;
+    }
+
+    printf("nmea_scanf:    %10.0f sentences/sec\n", rate_before);
+    printf("field parsers: %10.0f sentences/sec (x%.2f)\n", rate_after, rate_after / rate_before);
+
+    if(0 != memcmp(&before, &after, sizeof(nmeaINFO)))
+    {
+        fprintf(stderr, "nmea_bench: nmeaINFO differs\n");
+        return 1;
+    }
+
+    /* Taking turns, the best round of each, a busy host only slows some */
+    rate_before = rate_after = 0;
+    for(i = 0; i < BENCH_ROUNDS; ++i)
+    {
+        rate = frame(&bytewise_find_tail, &memcmp_pack_type, epochs / BENCH_ROUNDS, &check_before);
+        if(rate > rate_before)
+            rate_before = rate;
+        rate = frame(&nmea_find_tail, &nmea_pack_type, epochs / BENCH_ROUNDS, &check_after);
+        if(rate > rate_after)
+            rate_after = rate;
+    }
+
+    printf("bytewise framing: %10.0f sentences/sec\n", rate_before);
+    printf("word framing:     %10.0f sentences/sec (x%.2f)\n", rate_after, rate_after / rate_before);
+
+    if(check_before != check_after)
+    {
+        fprintf(stderr, "nmea_bench: framing differs\n");
+        return 1;
+    }
+
+    if(!coords(BENCH_COORDS, &old_err))
+    {
+        fprintf(stderr, "nmea_bench: coordinate round trip failed\n");
+        return 1;
+    }
+
+    printf("coordinates:      %d round trips within 0.5 nano-degrees, NDEG double conversion off by up to %.2g\n",
+        BENCH_COORDS * 3, old_err);
+
+    if(!times())
+    {
+        fprintf(stderr, "nmea_bench: time fraction wrong\n");
+        return 1;
+    }
+
+    printf("times:            0 - 3 fraction digits in hundredths\n");
+
+    return 0;
+}
@@ -65,3 +65,19 @@ LOCAL_CFLAGS += -DRIL_SHLIB
 LOCAL_CFLAGS += -Wall
 LOCAL_MODULE:= libmbm-ril
 include $(BUILD_SHARED_LIBRARY)
+
+# Host benchmark of the AT channel reader against a modem on a pty
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    at_bench.c \
+    atchannel.c \
+    at_tok.c \
+    misc.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE -Wall
+LOCAL_STATIC_LIBRARIES := libcutils liblog
+LOCAL_LDLIBS := -lpthread -lrt -lutil
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE:= at_bench
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,324 @@
+/*
+ * AT channel reader benchmark (host tool)
+ *
+ * Runs the real atchannel.c against a modem simulated on a
+ * pseudo-terminal. Every iteration lists the stored SMS with AT+CMGL=4,
+ * a header and a PDU line per message, and scans the networks with
+ * AT+COPS=?, one long line. After each final response the modem sends a
+ * burst of +CMT: SMS URCs, two lines each. Reports the time per
+ * command, the lines per second and the CPU time of the reader thread
+ * per line. Exits 1 if a line is lost, garbled or out of order, or with
+ * -C if the reader takes more CPU per line than given.
+ *
+ * Usage: at_bench [-i iterations] [-s sms] [-o operators] [-u urcs]
+ *                 [-C max_cpu_us_per_line]
+ */
+
+#include "atchannel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_ITERATIONS 100
+#define BENCH_SMS        50
+#define BENCH_OPERATORS  20
+#define BENCH_URCS       10
+#define BENCH_PDU_OCTETS 140
+#define BENCH_MAX_OUT    (256 * 1024)
+
+static int s_modemFd;
+static int s_sms = BENCH_SMS;
+static int s_operators = BENCH_OPERATORS;
+static int s_urcs = BENCH_URCS;
+
+static char s_pdu[2 * BENCH_PDU_OCTETS + 1];
+static char *s_cops;
+
+/* Lines the modem sent, and what the reader passed on. */
+static int s_linesSent;
+static int s_urcsSeen;
+static int s_urcsBad;
+
+static clockid_t s_readerClock;
+static int s_haveReaderClock;
+
+static double monotonicSec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double clockSec(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int append(char *out, int len, const char *s)
+{
+    int n = strlen(s);
+
+    if (len + n > BENCH_MAX_OUT) {
+        fprintf(stderr, "at_bench: response too long\n");
+        exit(2);
+    }
+    memcpy(out + len, s, n);
+    return len + n;
+}
+
+/* Answers a command, followed by the URC burst. */
+static int answer(const char *command, char *out)
+{
+    char line[64];
+    int len = 0, i;
+
+    if (strcmp(command, "AT+CMGL=4") == 0) {
+        for (i = 0; i < s_sms; i++) {
+            snprintf(line, sizeof(line), "\r\n+CMGL: %d,1,,%d\r\n",
+                     i, BENCH_PDU_OCTETS);
+            len = append(out, len, line);
+            len = append(out, len, s_pdu);
+            s_linesSent += 2;
+        }
+        len = append(out, len, "\r\n");
+    } else if (strcmp(command, "AT+COPS=?") == 0) {
+        len = append(out, len, "\r\n");
+        len = append(out, len, s_cops);
+        len = append(out, len, "\r\n");
+        s_linesSent++;
+    }
+
+    len = append(out, len, "\r\nOK\r\n");
+    s_linesSent++;
+
+    for (i = 0; i < s_urcs; i++) {
+        snprintf(line, sizeof(line), "\r\n+CMT: ,%d\r\n", BENCH_PDU_OCTETS);
+        len = append(out, len, line);
+        len = append(out, len, s_pdu);
+        len = append(out, len, "\r\n");
+        s_linesSent += 2;
+    }
+
+    return len;
+}
+
+static void *modemLoop(void *arg)
+{
+    char in[1024], *out;
+    int len = 0, n, cur, written;
+    char *cr;
+
+    (void) arg;
+    out = malloc(BENCH_MAX_OUT);
+
+    for (;;) {
+        n = read(s_modemFd, in + len, sizeof(in) - len - 1);
+        if (n <= 0)
+            break;
+        len += n;
+        in[len] = '\0';
+
+        while ((cr = strchr(in, '\r')) != NULL) {
+            *cr = '\0';
+            n = answer(in, out);
+            len -= cr + 1 - in;
+            memmove(in, cr + 1, len + 1);
+
+            for (cur = 0; cur < n; cur += written) {
+                written = write(s_modemFd, out + cur, n - cur);
+                if (written < 0 && errno != EINTR)
+                    goto done;
+                if (written < 0)
+                    written = 0;
+            }
+        }
+    }
+
+done:
+    free(out);
+    return NULL;
+}
+
+static void onUnsolicited(const char *s, const char *sms_pdu)
+{
+    if (strncmp(s, "+CMT:", 5) != 0)
+        return;
+    s_urcsSeen++;
+    if (sms_pdu == NULL || strcmp(sms_pdu, s_pdu) != 0)
+        s_urcsBad++;
+}
+
+/* Runs on the reader thread. */
+static void onStarted(int err, ATResponse *p_response, void *param)
+{
+    (void) err;
+    (void) param;
+    if (pthread_getcpuclockid(pthread_self(), &s_readerClock) == 0)
+        s_haveReaderClock = 1;
+    at_response_free(p_response);
+}
+
+/* Returns the number of lines that are wrong or missing. */
+static int checkList(const ATResponse *p_response)
+{
+    const ATLine *p_line;
+    char header[32];
+    int i = 0, bad = 0;
+
+    for (p_line = p_response->p_intermediates; p_line != NULL;
+         p_line = p_line->p_next, i++) {
+        if (i % 2 == 0) {
+            snprintf(header, sizeof(header), "+CMGL: %d,1,,%d",
+                     i / 2, BENCH_PDU_OCTETS);
+            bad += strcmp(p_line->line, header) != 0;
+        } else
+            bad += strcmp(p_line->line, s_pdu) != 0;
+    }
+
+    return bad + abs(2 * s_sms - i);
+}
+
+static int checkScan(const ATResponse *p_response)
+{
+    const ATLine *p_line = p_response->p_intermediates;
+
+    if (p_line == NULL || p_line->p_next != NULL)
+        return 1;
+    return strcmp(p_line->line, s_cops) != 0;
+}
+
+static void makeScan(void)
+{
+    char op[80];
+    int i, len;
+
+    s_cops = malloc(s_operators * sizeof(op) + 64);
+    len = sprintf(s_cops, "+COPS: ");
+    for (i = 0; i < s_operators; i++) {
+        snprintf(op, sizeof(op), "(%d,\"Operator %d\",\"Op%d\",\"240%02d\",2),",
+                 i == 0 ? 2 : 1, i, i, i % 100);
+        len += sprintf(s_cops + len, "%s", op);
+    }
+    sprintf(s_cops + len, ",(0,1,3,4),(0,1,2)");
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = BENCH_ITERATIONS;
+    double maxCpu = 0, t0, c0, elapsed, cpu;
+    ATResponse *p_response;
+    struct termios ios;
+    pthread_t modem;
+    int opt, fd, i, err, bad = 0, lines, urcs;
+
+    while ((opt = getopt(argc, argv, "i:s:o:u:C:")) != -1) {
+        switch (opt) {
+        case 'i': iterations = atoi(optarg); break;
+        case 's': s_sms = atoi(optarg); break;
+        case 'o': s_operators = atoi(optarg); break;
+        case 'u': s_urcs = atoi(optarg); break;
+        case 'C': maxCpu = atof(optarg); break;
+        default:
+            fprintf(stderr, "usage: at_bench [-i iterations] [-s sms] "
+                    "[-o operators] [-u urcs] [-C max_cpu_us_per_line]\n");
+            return 2;
+        }
+    }
+    if (iterations < 1 || s_sms < 1 || s_sms > 1000 || s_operators < 1
+            || s_operators > 100 || s_urcs < 0 || s_urcs > 1000) {
+        fprintf(stderr, "at_bench: out of range\n");
+        return 2;
+    }
+
+    for (i = 0; i < 2 * BENCH_PDU_OCTETS; i++)
+        s_pdu[i] = "0123456789ABCDEF"[(i * 7) & 15];
+    makeScan();
+
+    if (openpty(&s_modemFd, &fd, NULL, NULL, NULL) < 0) {
+        perror("openpty");
+        return 2;
+    }
+    tcgetattr(fd, &ios);
+    cfmakeraw(&ios);
+    tcsetattr(fd, TCSANOW, &ios);
+    tcgetattr(s_modemFd, &ios);
+    cfmakeraw(&ios);
+    tcsetattr(s_modemFd, TCSANOW, &ios);
+
+    pthread_create(&modem, NULL, modemLoop, NULL);
+    if (at_open(fd, onUnsolicited) < 0) {
+        fprintf(stderr, "at_bench: at_open failed\n");
+        return 2;
+    }
+
+    /* No URCs while starting up, they would count. */
+    urcs = s_urcs;
+    s_urcs = 0;
+    at_send_command_async("AT", NO_RESULT, NULL, onStarted, NULL);
+    at_send_command("AT");
+    s_urcs = urcs;
+    if (!s_haveReaderClock) {
+        fprintf(stderr, "at_bench: no reader thread clock\n");
+        return 2;
+    }
+
+    s_linesSent = 0;
+    s_urcsSeen = 0;
+    t0 = monotonicSec();
+    c0 = clockSec(s_readerClock);
+
+    for (i = 0; i < iterations; i++) {
+        /* The PDU lines have no prefix. */
+        err = at_send_command_multiline("AT+CMGL=4", "", &p_response);
+        if (err < 0 || p_response == NULL || !p_response->success)
+            bad++;
+        else
+            bad += checkList(p_response);
+        at_response_free(p_response);
+
+        err = at_send_command_multiline("AT+COPS=?", "+COPS:", &p_response);
+        if (err < 0 || p_response == NULL || !p_response->success)
+            bad++;
+        else
+            bad += checkScan(p_response);
+        at_response_free(p_response);
+    }
+
+    /* Once answered, the URCs after the last command are in too. */
+    s_urcs = 0;
+    at_send_command("AT");
+    elapsed = monotonicSec() - t0;
+    cpu = clockSec(s_readerClock) - c0;
+    lines = s_linesSent;
+
+    bad += abs(2 * iterations * urcs - s_urcsSeen) + s_urcsBad;
+
+    printf("%d iterations: %d SMS listed, %d operators, %d URCs each\n",
+           iterations, s_sms, s_operators, urcs);
+    printf("  %.0f us per command, %.0f lines/s\n",
+           elapsed * 1e6 / (2 * iterations), lines / elapsed);
+    printf("  reader CPU %.2f us per line, %.1f%% of the run\n",
+           cpu * 1e6 / lines, cpu * 100 / elapsed);
+    printf("  lines wrong or lost: %d\n", bad);
+
+    at_close();
+
+    if (bad > 0)
+        return 1;
+    if (maxCpu > 0 && cpu * 1e6 / lines > maxCpu) {
+        printf("  over the CPU limit of %.2f us per line\n", maxCpu);
+        return 1;
+    }
+    return 0;
+}
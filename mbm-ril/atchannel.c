@@ -36,7 +36,8 @@
 #include <unistd.h>
 #include <stdarg.h>
 
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 
 #define LOG_NDEBUG 0
 #define LOG_TAG "AT"
@@ -50,39 +51,110 @@
 #include "misc.h"
 
 #define MAX_AT_RESPONSE (8 * 1024)
+#define AT_RING_SIZE (16 * 1024)    /* Power of two, > MAX_AT_RESPONSE. */
 #define HANDSHAKE_RETRY_COUNT 8
 #define HANDSHAKE_TIMEOUT_MSEC 250
 #define DEFAULT_AT_TIMEOUT_MSEC (3 * 60 * 1000)
 #define BUFFSIZE 512
+#define MAX_AT_INFLIGHT 4
+#define ARENA_INLINE 256
+#define ARENA_CHUNK 2048
+
+/* Result of a synchronous command, on the stack of its sender. */
+struct atwait {
+    int done;
+    int err;
+    ATResponse *response;
+    long long deadline;     /* Set once written, 0 means not yet. */
+};
+
+/* A command of the in-flight window. */
+struct atcommand {
+    char command[BUFFSIZE];
+    ATCommandType type;
+    const char *responsePrefix;
+    const char *smsPDU;
+    ATResponse *response;
+
+    /* Commands of a batch line, batchCursor is the one answering. */
+    ATBatchCommand *batch;
+    int batchCount;
+    int batchCursor;
+
+    /* Either a synchronous sender waits for it, or done is called. */
+    struct atwait *wait;
+    ATCompletion done;
+    void *param;
+    long long timeoutMsec;  /* From the write on, 0 means none. */
+    long long deadline;     /* Monotonic msec, 0 means none or unwritten. */
+};
+
+/* An asynchronous command completed, its callback is run unlocked. */
+struct atcompletion {
+    ATCompletion done;
+    void *param;
+    int err;
+    ATResponse *response;
+};
+
+/* More room for the lines of a response, freed with it. */
+struct atchunk {
+    struct atchunk *next;
+    /* The lines follow. */
+};
+
+/*
+ * An ATResponse and the bump arena of its lines and final response. Lines
+ * are linked in the order they come, the first ones fit in the space of
+ * the response itself, so it is freed in one go.
+ */
+struct atresponse {
+    ATResponse response;        /* First, callers only see this. */
+    ATLine **tail;              /* Where the next line is linked. */
+    char *cur;                  /* Free part of the arena. */
+    size_t left;
+    struct atchunk *chunks;
+    void *space[ARENA_INLINE / sizeof(void *)];
+};
 
 struct atcontext {
     pthread_t tid_reader;
     int fd;                  /* fd of the AT channel. */
     int readerCmdFds[2];
+    int epollFd;             /* Waits for fd and readerCmdFds[0]. */
     int isInitialized;
     ATUnsolHandler unsolHandler;
 
-    /* For input buffering. */
-    char ATBuffer[MAX_AT_RESPONSE+1];
-    char *ATBufferCur;
+    /*
+     * For input buffering, a ring of what was read and not yet returned
+     * as a line. The positions run freely, masked on access. A line that
+     * wraps around the end is returned from ATLine.
+     */
+    char ATRing[AT_RING_SIZE];
+    unsigned int ringHead;   /* Start of the next line. */
+    unsigned int ringScan;   /* Up to here no end of line was found. */
+    unsigned int ringTail;   /* Where the next read goes. */
+    char ATLine[MAX_AT_RESPONSE+1];
 
     int readCount;
 
     /*
-     * For current pending command, these are protected by commandmutex.
+     * The in-flight window, protected by commandmutex. commands[head] is
+     * the oldest, the only one written to the modem (when written is set):
+     * V.250 lets a modem abort a command that gets more input, so the next
+     * one is written by the reader thread as soon as the final response
+     * arrives, without waking up its sender first.
      *
      * The mutex and cond struct is memset in the getAtChannel() function,
      * so no initializer should be needed.
      */
-    pthread_mutex_t requestmutex;
     pthread_mutex_t commandmutex;
-    pthread_cond_t requestcond;
     pthread_cond_t commandcond;
 
-    ATCommandType type;
-    const char *responsePrefix;
-    const char *smsPDU;
-    ATResponse *response;
+    struct atcommand commands[MAX_AT_INFLIGHT];
+    int head;
+    int count;
+    int written;
 
     void (*onTimeout)(void);
     void (*onReaderClosed)(void);
@@ -100,6 +172,7 @@ static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 static int writeCtrlZ (const char *s);
 static int writeline (const char *s);
 static void onReaderClosed(void);
+static AT_Error at_get_error(const ATResponse *p_response);
 
 static void make_key(void)
 {
@@ -135,6 +208,7 @@ static void ac_free(void)
 static int initializeAtContext(void)
 {
     struct atcontext *ac = NULL;
+    struct epoll_event ev;
 
     if (pthread_once(&key_once, make_key)) {
         LOGE("%s() Pthread_once failed!", __func__);
@@ -155,16 +229,27 @@ static int initializeAtContext(void)
         ac->fd = -1;
         ac->readerCmdFds[0] = -1;
         ac->readerCmdFds[1] = -1;
-        ac->ATBufferCur = ac->ATBuffer;
 
         if (pipe(ac->readerCmdFds)) {
             LOGE("%s() Failed to create pipe: %s", __func__, strerror(errno));
             goto error;
         }
 
+        ac->epollFd = epoll_create(2);
+        if (ac->epollFd < 0) {
+            LOGE("%s() Failed to create epoll: %s", __func__, strerror(errno));
+            goto error;
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = ac->readerCmdFds[0];
+        if (epoll_ctl(ac->epollFd, EPOLL_CTL_ADD, ac->readerCmdFds[0], &ev)) {
+            LOGE("%s() Failed to watch pipe: %s", __func__, strerror(errno));
+            goto error;
+        }
+
         pthread_mutex_init(&ac->commandmutex, NULL);
-        pthread_mutex_init(&ac->requestmutex, NULL);
-        pthread_cond_init(&ac->requestcond, NULL);
         pthread_cond_init(&ac->commandcond, NULL);
 
         ac->timeoutMsec = DEFAULT_AT_TIMEOUT_MSEC;
@@ -237,6 +322,10 @@ int pthread_cond_timeout_np(pthread_cond_t *cond,
 
     ts.tv_sec += msecs / 1000;
     ts.tv_nsec += (msecs % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
     return pthread_cond_timedwait(cond, mutex, &ts);
 }
 #endif /*HAVE_ANDROID_OS*/
@@ -256,23 +345,145 @@ static void sleepMsec(long long msec)
 
 
 
-/** Add an intermediate response to sp_response. */
-static void addIntermediate(const char *line)
+static long long monotonicMsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static ATResponse *at_response_new(void)
+{
+    struct atresponse *r;
+
+    r = (struct atresponse *) malloc(sizeof(struct atresponse));
+    if (r == NULL)
+        return NULL;
+
+    memset(&r->response, 0, sizeof(ATResponse));
+    r->tail = &r->response.p_intermediates;
+    r->cur = (char *) r->space;
+    r->left = sizeof(r->space);
+    r->chunks = NULL;
+
+    return &r->response;
+}
+
+/** Takes size bytes, aligned for an ATLine, from the arena of response. */
+static void *arenaAlloc(ATResponse *response, size_t size)
 {
+    struct atresponse *r = (struct atresponse *) response;
+    struct atchunk *chunk;
+    size_t chunkSize;
+    void *p;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (size > r->left) {
+        chunkSize = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        chunk = (struct atchunk *) malloc(sizeof(struct atchunk) + chunkSize);
+        if (chunk == NULL)
+            return NULL;
+
+        /* The rest of the current one is left unused. */
+        chunk->next = r->chunks;
+        r->chunks = chunk;
+        r->cur = (char *) (chunk + 1);
+        r->left = chunkSize;
+    }
+
+    p = r->cur;
+    r->cur += size;
+    r->left -= size;
+
+    return p;
+}
+
+static char *arenaStrdup(ATResponse *response, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = arenaAlloc(response, len);
+
+    if (p != NULL)
+        memcpy(p, s, len);
+
+    return p;
+}
+
+/**
+ * Add an intermediate response to the command being answered, after the
+ * ones it has. Returns -1 if out of memory.
+ */
+static int addIntermediate(ATResponse *response, const char *line)
+{
+    struct atresponse *r = (struct atresponse *) response;
+    size_t len = strlen(line) + 1;
     ATLine *p_new;
-    struct atcontext *ac = getAtContext();
 
-    p_new = (ATLine  *) malloc(sizeof(ATLine));
+    /* The line is stored right after its node. */
+    p_new = (ATLine *) arenaAlloc(response, sizeof(ATLine) + len);
+    if (p_new == NULL) {
+        LOGE("%s() Failed to allocate memory", __func__);
+        return -1;
+    }
+
+    p_new->line = (char *) (p_new + 1);
+    memcpy(p_new->line, line, len);
+    p_new->p_next = NULL;
 
-    p_new->line = strdup(line);
+    *r->tail = p_new;
+    r->tail = &p_new->p_next;
 
-    /* Note: This adds to the head of the list, so the list will
-       be in reverse order of lines received. the order is flipped
-       again before passing on to the command issuer. */
-    p_new->p_next = ac->response->p_intermediates;
-    ac->response->p_intermediates = p_new;
+    return 0;
 }
 
+/**
+ * Returns 1 if line is an intermediate response of a command of the given
+ * type that has got "response" so far.
+ */
+static int isIntermediate(ATCommandType type, const char *responsePrefix,
+                          const ATResponse *response, const char *line)
+{
+    switch (type) {
+    case NO_RESULT:
+        return 0;
+    case NUMERIC:
+        /* Unless we already have an intermediate response. */
+        return response->p_intermediates == NULL && isdigit(line[0]);
+    case SINGLELINE:
+        return response->p_intermediates == NULL
+            && strStartsWith(line, responsePrefix);
+    case MULTILINE:
+        return strStartsWith(line, responsePrefix);
+    default: /* This should never be reached */
+        LOGE("%s() Unsupported AT command type %d", __func__, type);
+        return 0;
+    }
+}
+
+
+/**
+ * Sorts a line of a batch to the first command, from the one answering on,
+ * that takes it. The modem answers the commands in order, so the earlier
+ * ones are done. Returns 0 if no command takes it.
+ */
+static int addBatchIntermediate(struct atcommand *cmd, const char *line)
+{
+    ATBatchCommand *b;
+    int i;
+
+    for (i = cmd->batchCursor; i < cmd->batchCount; i++) {
+        b = &cmd->batch[i];
+        if (isIntermediate(b->type, b->responsePrefix, b->p_response, line)) {
+            addIntermediate(b->p_response, line);
+            cmd->batchCursor = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
 
 /**
  * Returns 1 if line is a final response indicating error.
@@ -345,14 +556,115 @@ static int isSMSUnsolicited(const char *line)
 }
 
 
-/** Assumes s_commandmutex is held. */
-static void handleFinalResponse(const char *line)
+/**
+ * Takes the oldest command out of the window with its result. A waiting
+ * sender gets it right away, the callback of an asynchronous command is
+ * left in *out for runCompletion(). Assumes commandmutex is held.
+ */
+static void completeCommand(struct atcontext *ac, int err,
+                            struct atcompletion *out)
+{
+    struct atcommand *cmd = &ac->commands[ac->head];
+    ATResponse *response = cmd->response;
+
+    if (cmd->wait != NULL) {
+        cmd->wait->done = 1;
+        cmd->wait->err = err;
+        cmd->wait->response = response;
+        out->done = NULL;
+    } else {
+        /* Like the synchronous calls, an answer without the intermediate
+           response it should have is an error, and failures have none. */
+        if (err == AT_NOERROR && cmd->type != NO_RESULT && response != NULL
+                && response->p_intermediates == NULL)
+            err = AT_ERROR_INVALID_RESPONSE;
+        if (err != AT_NOERROR) {
+            at_response_free(response);
+            response = NULL;
+        }
+        out->done = cmd->done;
+        out->param = cmd->param;
+        out->err = -err;
+        out->response = response;
+    }
+
+    memset(cmd, 0, sizeof(*cmd));
+    ac->head = (ac->head + 1) % MAX_AT_INFLIGHT;
+    ac->count--;
+    ac->written = 0;
+
+    /* Wakes the senders, of this command and of those waiting for room. */
+    pthread_cond_broadcast(&ac->commandcond);
+}
+
+static void runCompletion(struct atcompletion *c)
+{
+    if (c->done != NULL)
+        c->done(c->err, c->response, c->param);
+}
+
+/**
+ * Fails every command of the window with err, e.g. when the channel is
+ * closed or a command timed out. Callbacks are returned in out, which
+ * holds MAX_AT_INFLIGHT. Assumes commandmutex is held.
+ */
+static int abortCommands(struct atcontext *ac, int err,
+                         struct atcompletion *out)
+{
+    int n = 0;
+
+    while (ac->count > 0) {
+        completeCommand(ac, err, &out[n]);
+        if (out[n].done != NULL)
+            n++;
+    }
+
+    return n;
+}
+
+/**
+ * Writes the oldest command of the window if nothing is on the wire.
+ * A command that cannot be written fails, and the next one is tried.
+ * Assumes commandmutex is held.
+ */
+static int startCommand(struct atcontext *ac, struct atcompletion *out)
+{
+    struct atcommand *cmd;
+    int err, n = 0;
+
+    while (ac->count > 0 && !ac->written) {
+        cmd = &ac->commands[ac->head];
+        err = writeline(cmd->command);
+        if (err == AT_NOERROR) {
+            ac->written = 1;
+            /* Time spent behind the commands before it does not count. */
+            if (cmd->timeoutMsec != 0)
+                cmd->deadline = monotonicMsec() + cmd->timeoutMsec;
+            if (cmd->wait != NULL)
+                cmd->wait->deadline = cmd->deadline;
+            break;
+        }
+        completeCommand(ac, err, &out[n]);
+        if (out[n].done != NULL)
+            n++;
+    }
+
+    return n;
+}
+
+/** Assumes commandmutex is held. */
+static void handleFinalResponse(const char *line, struct atcompletion *out)
 {
     struct atcontext *ac = getAtContext();
+    struct atcommand *cmd = &ac->commands[ac->head];
+    int err = AT_NOERROR;
+
+    cmd->response->finalResponse = arenaStrdup(cmd->response, line);
 
-    ac->response->finalResponse = strdup(line);
+    if (cmd->response->success == 0)
+        err = at_get_error(cmd->response);
 
-    pthread_cond_signal(&ac->commandcond);
+    completeCommand(ac, err, &out[0]);
 }
 
 static void handleUnsolicited(const char *line)
@@ -367,248 +679,342 @@ static void handleUnsolicited(const char *line)
 static void processLine(const char *line)
 {
     struct atcontext *ac = getAtContext();
+    struct atcompletion done[1 + MAX_AT_INFLIGHT];
+    struct atcommand *cmd = NULL;
+    int i, n = 0;
+
     pthread_mutex_lock(&ac->commandmutex);
 
-    if (ac->response == NULL) {
+    if (ac->count > 0 && ac->written)
+        cmd = &ac->commands[ac->head];
+
+    if (cmd == NULL) {
         /* No command pending. */
         handleUnsolicited(line);
     } else if (isFinalResponseSuccess(line)) {
-        ac->response->success = 1;
-        handleFinalResponse(line);
+        cmd->response->success = 1;
+        handleFinalResponse(line, done);
+        n = 1;
     } else if (isFinalResponseError(line)) {
-        ac->response->success = 0;
-        handleFinalResponse(line);
-    } else if (ac->smsPDU != NULL && 0 == strcmp(line, "> ")) {
+        cmd->response->success = 0;
+        handleFinalResponse(line, done);
+        n = 1;
+    } else if (cmd->smsPDU != NULL && 0 == strcmp(line, "> ")) {
         /* See eg. TS 27.005 4.3.
            Commands like AT+CMGS have a "> " prompt. */
-        writeCtrlZ(ac->smsPDU);
-        ac->smsPDU = NULL;
-    } else switch (ac->type) {
-        case NO_RESULT:
+        writeCtrlZ(cmd->smsPDU);
+        cmd->smsPDU = NULL;
+    } else if (cmd->batch != NULL) {
+        if (!addBatchIntermediate(cmd, line))
             handleUnsolicited(line);
-            break;
-        case NUMERIC:
-            if (ac->response->p_intermediates == NULL
-                && isdigit(line[0])) {
-                addIntermediate(line);
-            } else {
-                /* Either we already have an intermediate response or
-                   the line doesn't begin with a digit. */
-                handleUnsolicited(line);
-            }
-            break;
-        case SINGLELINE:
-            if (ac->response->p_intermediates == NULL
-                && strStartsWith (line, ac->responsePrefix)) {
-                addIntermediate(line);
-            } else {
-                /* We already have an intermediate response. */
-                handleUnsolicited(line);
-            }
-            break;
-        case MULTILINE:
-            if (strStartsWith (line, ac->responsePrefix)) {
-                addIntermediate(line);
-            } else {
-                handleUnsolicited(line);
-            }
-        break;
-
-        default: /* This should never be reached */
-            LOGE("%s() Unsupported AT command type %d", __func__, ac->type);
-            handleUnsolicited(line);
-        break;
+    } else if (isIntermediate(cmd->type, cmd->responsePrefix,
+                              cmd->response, line)) {
+        addIntermediate(cmd->response, line);
+    } else {
+        /* Not of this command, or we already have its response. */
+        handleUnsolicited(line);
     }
 
+    /* The next command goes out before anyone hears of this one. */
+    if (n > 0)
+        n += startCommand(ac, done + n);
+
     pthread_mutex_unlock(&ac->commandmutex);
-}
 
+    for (i = 0; i < n; i++)
+        runCompletion(&done[i]);
+}
 
 /**
- * Returns a pointer to the end of the next line,
- * special-cases the "> " SMS prompt.
- *
- * returns NULL if there is no complete line.
+ * Milliseconds until the asynchronous command on the wire times out, -1 if
+ * none is. Synchronous ones are timed by their sender.
  */
-static char * findNextEOL(char *cur)
+static long long commandTimeLeft(struct atcontext *ac)
 {
-    if (cur[0] == '>' && cur[1] == ' ' && cur[2] == '\0') {
-        /* SMS prompt character...not \r terminated */
-        return cur+2;
-    }
+    struct atcommand *cmd = &ac->commands[ac->head];
+    long long left = -1;
 
-    /* Find next newline */
-    while (*cur != '\0' && *cur != '\r' && *cur != '\n') cur++;
+    if (ac->count > 0 && ac->written && cmd->wait == NULL && cmd->deadline) {
+        left = cmd->deadline - monotonicMsec();
+        if (left < 0)
+            left = 0;
+    }
 
-    return *cur == '\0' ? NULL : cur;
+    return left;
 }
 
+static int pendingTimeoutMsec(struct atcontext *ac)
+{
+    long long left;
+
+    pthread_mutex_lock(&ac->commandmutex);
+    left = commandTimeLeft(ac);
+    pthread_mutex_unlock(&ac->commandmutex);
+
+    return (int) left;
+}
 
 /**
- * Reads a line from the AT channel, returns NULL on timeout.
- * Assumes it has exclusive read access to the FD.
- *
- * This line is valid only until the next call to readline.
- *
- * This function exists because as of writing, android libc does not
- * have buffered stdio.
+ * The modem did not answer an asynchronous command in time. Fails the
+ * window and, as the modem may still answer, lets onTimeout restart the
+ * channel.
  */
-
-static const char *readline(void)
+static void expireCommands(struct atcontext *ac)
 {
-    ssize_t count;
+    struct atcompletion done[MAX_AT_INFLIGHT];
+    int i, n = 0;
 
-    char *p_read = NULL;
-    char *p_eol = NULL;
-    char *ret = NULL;
+    pthread_mutex_lock(&ac->commandmutex);
+    if (commandTimeLeft(ac) == 0)
+        n = abortCommands(ac, AT_ERROR_TIMEOUT, done);
+    else
+        n = -1;
+    pthread_mutex_unlock(&ac->commandmutex);
 
-    struct atcontext *ac = getAtContext();
-    read(ac->fd,NULL,0);
+    if (n < 0)
+        return;
 
-    /* This is a little odd. I use *s_ATBufferCur == 0 to mean
-     * "buffer consumed completely". If it points to a character,
-     * then the buffer continues until a \0.
-     */
-    if (*ac->ATBufferCur == '\0') {
-        /* Empty buffer. */
-        ac->ATBufferCur = ac->ATBuffer;
-        *ac->ATBufferCur = '\0';
-        p_read = ac->ATBuffer;
-    } else {   /* *s_ATBufferCur != '\0' */
-        /* There's data in the buffer from the last read. */
+    LOGE("%s() Asynchronous command timed out", __func__);
+    for (i = 0; i < n; i++)
+        runCompletion(&done[i]);
+
+    if (ac->onTimeout != NULL)
+        ac->onTimeout();
+}
 
-        /* skip over leading newlines */
-        while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
-            ac->ATBufferCur++;
+/**
+ * Returns the offset of the first \r or \n in the len bytes at p, len if
+ * there is none. Looks at a word at a time.
+ */
+static size_t findEOL(const char *p, size_t len)
+{
+    /* SWAR constants, a byte of the word is zero if (w - ones) & ~w & highs */
+    const unsigned long ones = ~0UL / 0xFF;
+    const unsigned long highs = ones << 7;
+    const unsigned long crs = ones * '\r';
+    const unsigned long lfs = ones * '\n';
+    unsigned long word, cr, lf;
+    size_t i;
 
-        p_eol = findNextEOL(ac->ATBufferCur);
+    for (i = 0; i + sizeof(word) <= len; i += sizeof(word)) {
+        memcpy(&word, p + i, sizeof(word));
+        cr = word ^ crs;
+        lf = word ^ lfs;
+        if ((((cr - ones) & ~cr) | ((lf - ones) & ~lf)) & highs)
+            break;
+    }
 
-        if (p_eol == NULL) {
-            /* A partial line. Move it up and prepare to read more. */
-            size_t len;
+    for (; i < len; i++)
+        if (p[i] == '\r' || p[i] == '\n')
+            break;
 
-            len = strlen(ac->ATBufferCur);
+    return i;
+}
 
-            memmove(ac->ATBuffer, ac->ATBufferCur, len + 1);
-            p_read = ac->ATBuffer + len;
-            ac->ATBufferCur = ac->ATBuffer;
-        }
-        /* Otherwise, (p_eol !- NULL) there is a complete line 
-           that will be returned from the while () loop below. */
+/**
+ * Takes the next complete line out of the ring, NULL if there is none.
+ * Special-cases the "> " SMS prompt, which is not \r terminated.
+ */
+static const char *nextLine(struct atcontext *ac)
+{
+    const unsigned int mask = AT_RING_SIZE - 1;
+    unsigned int start, len, first;
+    size_t n, eol;
+    char *line;
+
+    /* Skip over leading newlines. */
+    while (ac->ringHead != ac->ringTail
+           && (ac->ATRing[ac->ringHead & mask] == '\r'
+               || ac->ATRing[ac->ringHead & mask] == '\n'))
+        ac->ringHead++;
+
+    if (ac->ringScan - ac->ringHead > ac->ringTail - ac->ringHead)
+        ac->ringScan = ac->ringHead;
+
+    if (ac->ringTail - ac->ringHead == 2
+            && ac->ATRing[ac->ringHead & mask] == '>'
+            && ac->ATRing[(ac->ringHead + 1) & mask] == ' ') {
+        ac->ringHead = ac->ringScan = ac->ringTail;
+        return "> ";
     }
 
-    while (p_eol == NULL) {
-        int err;
-        struct pollfd pfds[2];
+    /* Scan what is new, in up to two pieces if it wraps. */
+    while (ac->ringScan != ac->ringTail) {
+        start = ac->ringScan & mask;
+        n = ac->ringTail - ac->ringScan;
+        if (n > AT_RING_SIZE - start)
+            n = AT_RING_SIZE - start;
 
-        /* This condition should be synchronized with the read function call
-         * size argument below.
-         */
-        if (0 >= MAX_AT_RESPONSE - (p_read - ac->ATBuffer) - 2) {
+        eol = findEOL(ac->ATRing + start, n);
+        ac->ringScan += eol;
+        if (eol < n)
+            break;
+    }
+
+    len = ac->ringScan - ac->ringHead;
+
+    if (ac->ringScan == ac->ringTail) {
+        if (len >= MAX_AT_RESPONSE) {
             LOGE("%s() ERROR: Input line exceeded buffer", __func__);
             /* Ditch buffer and start over again. */
-            ac->ATBufferCur = ac->ATBuffer;
-            *ac->ATBufferCur = '\0';
-            p_read = ac->ATBuffer;
+            ac->ringHead = ac->ringScan = ac->ringTail;
         }
+        return NULL;
+    }
 
-        /* If our fd is invalid, we are probably closed. Return. */
-        if (ac->fd < 0)
-            return NULL;
+    start = ac->ringHead & mask;
+    ac->ringHead = ++ac->ringScan;
 
-        pfds[0].fd = ac->fd;
-        pfds[0].events = POLLIN | POLLERR;
+    if (len > MAX_AT_RESPONSE) {
+        LOGE("%s() ERROR: Input line exceeded buffer", __func__);
+        return nextLine(ac);
+    }
 
-        pfds[1].fd = ac->readerCmdFds[0];
-        pfds[1].events = POLLIN;
+    /* In place with a \0 over the \r, unless it wraps around. */
+    if (start + len < AT_RING_SIZE) {
+        line = ac->ATRing + start;
+    } else {
+        first = AT_RING_SIZE - start;
+        memcpy(ac->ATLine, ac->ATRing + start, first);
+        memcpy(ac->ATLine + first, ac->ATRing, len - first);
+        line = ac->ATLine;
+    }
+    line[len] = '\0';
 
-        err = poll(pfds, 2, -1);
+    return line;
+}
 
-        if (err < 0) {
-            LOGE("%s() poll: error: %s", __func__, strerror(errno));
-            return NULL;
-        }
+/**
+ * Waits for input and reads what there is into the ring. Returns 0 when
+ * woken up or when an asynchronous command expired, -1 on error, end of
+ * file or a closed channel.
+ */
+static int fillRing(struct atcontext *ac)
+{
+    const unsigned int mask = AT_RING_SIZE - 1;
+    struct epoll_event events[2];
+    struct iovec iov[2];
+    unsigned int start, room;
+    ssize_t count;
+    int i, n;
+    char buf[16];
+
+    /* If our fd is invalid, we are probably closed. Return. */
+    if (ac->fd < 0)
+        return -1;
 
-        if (pfds[1].revents & POLLIN) {
-            char buf[10];
+    n = epoll_wait(ac->epollFd, events, 2, pendingTimeoutMsec(ac));
 
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        LOGE("%s() epoll: error: %s", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (n == 0) {
+        expireCommands(ac);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (events[i].data.fd == ac->readerCmdFds[0]) {
             /* Just drain it. We don't care, this is just for waking up. */
-            read(pfds[1].fd, &buf, 1);
+            read(ac->readerCmdFds[0], buf, sizeof(buf));
             continue;
         }
 
-        if (pfds[0].revents & POLLERR) {
-            LOGE("%s() POLLERR event! Returning...", __func__);
-            return NULL;
+        if (events[i].data.fd != ac->fd)
+            continue;
+
+        if (events[i].events & EPOLLERR) {
+            LOGE("%s() EPOLLERR event! Returning...", __func__);
+            return -1;
         }
 
-        if (!(pfds[0].revents & POLLIN))
-            continue;
+        /* The ring always has room for more than a line. */
+        start = ac->ringTail & mask;
+        room = AT_RING_SIZE - (ac->ringTail - ac->ringHead);
+        iov[0].iov_base = ac->ATRing + start;
+        iov[0].iov_len = room < AT_RING_SIZE - start ?
+                         room : AT_RING_SIZE - start;
+        iov[1].iov_base = ac->ATRing;
+        iov[1].iov_len = room - iov[0].iov_len;
 
         do
-            /* The size argument should be synchronized to the ditch buffer
-             * condition above.
-             */
-            count = read(ac->fd, p_read,
-                         MAX_AT_RESPONSE - (p_read - ac->ATBuffer) - 2);
-
+            count = readv(ac->fd, iov, iov[1].iov_len > 0 ? 2 : 1);
         while (count < 0 && errno == EINTR);
 
-        if (count > 0) {
-            AT_DUMP( "<< ", p_read, count );
-            ac->readCount += count;
-
-            /* Implementation requires extra EOS or EOL to get it right if
-             * there are no trailing newlines in the read buffer. Adding extra
-             * EOS does not harm even if there actually were trailing EOLs.
-             */
-            p_read[count] = '\0';
-            p_read[count+1] = '\0';
-
-            /* Skip over leading newlines. */
-            while (*ac->ATBufferCur == '\r' || *ac->ATBufferCur == '\n')
-                ac->ATBufferCur++;
-
-            p_eol = findNextEOL(ac->ATBufferCur);
-            p_read += count;
-        } else if (count <= 0) {
+        if (count <= 0) {
             /* Read error encountered or EOF reached. */
             if (count == 0)
                 LOGD("%s() atchannel: EOF reached.", __func__);
             else
                 LOGD("%s() atchannel: read error %s", __func__, strerror(errno));
 
-            return NULL;
+            return -1;
         }
+
+        AT_DUMP("<< ", ac->ATRing + start, (size_t) count < iov[0].iov_len ?
+                (size_t) count : iov[0].iov_len);
+        if ((size_t) count > iov[0].iov_len)
+            AT_DUMP("<< ", ac->ATRing, count - iov[0].iov_len);
+        ac->readCount += count;
+        ac->ringTail += count;
     }
 
-    /* A full line in the buffer. Place a \0 over the \r and return. */
+    return 0;
+}
 
-    ret = ac->ATBufferCur;
-    *p_eol = '\0';
+/**
+ * Reads a line from the AT channel, returns NULL when the channel closes.
+ * Assumes it has exclusive read access to the FD.
+ *
+ * This line is valid only until the next call to readline. The lines of
+ * a read are all returned before waiting for more input.
+ *
+ * This function exists because as of writing, android libc does not
+ * have buffered stdio.
+ */
+static const char *readline(void)
+{
+    struct atcontext *ac = getAtContext();
+    const char *line;
 
-    /* The extra EOS added after read takes care of the case when there is no
-     * valid data after p_eol.
-     */
-    ac->ATBufferCur = p_eol + 1;     /* This will always be <= p_read,    
-                                        and there will be a \0 at *p_read. */
+    while ((line = nextLine(ac)) == NULL)
+        if (fillRing(ac) < 0)
+            return NULL;
 
-    LOGI("AT(%d)< %s", ac->fd, ret);
-    return ret;
+    LOGI("AT(%d)< %s", ac->fd, line);
+    return line;
 }
 
-static void onReaderClosed(void)
+/** Marks the channel closed and fails the commands in flight. */
+static void closeCommands(struct atcontext *ac)
 {
-    struct atcontext *ac = getAtContext();
-    if (ac->onReaderClosed != NULL && ac->readerClosed == 0) {
+    struct atcompletion done[MAX_AT_INFLIGHT];
+    int i, n;
 
-        pthread_mutex_lock(&ac->commandmutex);
+    pthread_mutex_lock(&ac->commandmutex);
 
-        ac->readerClosed = 1;
+    ac->readerClosed = 1;
 
-        pthread_cond_signal(&ac->commandcond);
+    n = abortCommands(ac, AT_ERROR_CHANNEL_CLOSED, done);
 
-        pthread_mutex_unlock(&ac->commandmutex);
+    pthread_cond_broadcast(&ac->commandcond);
+
+    pthread_mutex_unlock(&ac->commandmutex);
+
+    for (i = 0; i < n; i++)
+        runCompletion(&done[i]);
+}
+
+static void onReaderClosed(void)
+{
+    struct atcontext *ac = getAtContext();
+    if (ac->onReaderClosed != NULL && ac->readerClosed == 0) {
+
+        closeCommands(ac);
 
         ac->onReaderClosed();
     }
@@ -746,17 +1152,6 @@ static int writeCtrlZ (const char *s)
     return 0;
 }
 
-static void clearPendingCommand(void)
-{
-    struct atcontext *ac = getAtContext();
-
-    if (ac->response != NULL)
-        at_response_free(ac->response);
-
-    ac->response = NULL;
-    ac->responsePrefix = NULL;
-    ac->smsPDU = NULL;
-}
 
 static int merror(int type, int error)
 {
@@ -826,6 +1221,7 @@ int at_open(int fd, ATUnsolHandler h)
 {
     int ret;
     pthread_attr_t attr;
+    struct epoll_event ev;
 
     struct atcontext *ac = NULL;
 
@@ -841,9 +1237,24 @@ int at_open(int fd, ATUnsolHandler h)
     ac->unsolHandler = h;
     ac->readerClosed = 0;
 
-    ac->responsePrefix = NULL;
-    ac->smsPDU = NULL;
-    ac->response = NULL;
+    ac->head = 0;
+    ac->count = 0;
+    ac->written = 0;
+
+    ac->ringHead = 0;
+    ac->ringScan = 0;
+    ac->ringTail = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    /* A closed fd leaves the set, unless the number is still open. */
+    if (epoll_ctl(ac->epollFd, EPOLL_CTL_ADD, fd, &ev)
+            && (errno != EEXIST
+                || epoll_ctl(ac->epollFd, EPOLL_CTL_MOD, fd, &ev))) {
+        LOGE("%s() Failed to watch fd %d: %s", __func__, fd, strerror(errno));
+        goto error;
+    }
 
     pthread_attr_init (&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
@@ -873,144 +1284,247 @@ void at_close(void)
     }
     ac->fd = -1;
 
-    pthread_mutex_lock(&ac->commandmutex);
-
-    ac->readerClosed = 1;
-
-    pthread_cond_signal(&ac->commandcond);
-
-    pthread_mutex_unlock(&ac->commandmutex);
+    closeCommands(ac);
 
     /* Kick readerloop. */
     write(ac->readerCmdFds[1], "x", 1);
 }
 
-static ATResponse *at_response_new(void)
+void at_response_free(ATResponse *p_response)
 {
-    return (ATResponse *) calloc(1, sizeof(ATResponse));
+    struct atresponse *r = (struct atresponse *) p_response;
+    struct atchunk *chunk;
+
+    if (p_response == NULL) return;
+
+    /* The lines are in the arena. */
+    while ((chunk = r->chunks) != NULL) {
+        r->chunks = chunk->next;
+        free(chunk);
+    }
+
+    free(r);
 }
 
-void at_response_free(ATResponse *p_response)
+/** Returns a copy of p_response, NULL if it is NULL or out of memory. */
+ATResponse *at_response_copy(const ATResponse *p_response)
 {
+    ATResponse *p_copy;
     ATLine *p_line;
 
-    if (p_response == NULL) return;
+    if (p_response == NULL)
+        return NULL;
 
-    p_line = p_response->p_intermediates;
+    p_copy = at_response_new();
+    if (p_copy == NULL)
+        return NULL;
 
-    while (p_line != NULL) {
-        ATLine *p_toFree;
+    p_copy->success = p_response->success;
+    if (p_response->finalResponse != NULL) {
+        p_copy->finalResponse = arenaStrdup(p_copy, p_response->finalResponse);
+        if (p_copy->finalResponse == NULL)
+            goto error;
+    }
+
+    for (p_line = p_response->p_intermediates; p_line != NULL;
+         p_line = p_line->p_next)
+        if (addIntermediate(p_copy, p_line->line) < 0)
+            goto error;
 
-        p_toFree = p_line;
-        p_line = p_line->p_next;
+    return p_copy;
 
-        free(p_toFree->line);
-        free(p_toFree);
-    }
+error:
+    at_response_free(p_copy);
+    return NULL;
+}
 
-    free (p_response->finalResponse);
-    free (p_response);
+/**
+ * Returns a successful response with line as its intermediate response,
+ * e.g. to keep an unsolicited +CREG: as the answer to +CREG?. NULL if out
+ * of memory.
+ */
+ATResponse *at_response_from_line(const char *line)
+{
+    ATResponse *p_response;
+
+    p_response = at_response_new();
+    if (p_response == NULL)
+        return NULL;
+
+    p_response->success = 1;
+    p_response->finalResponse = arenaStrdup(p_response, "OK");
+    if (p_response->finalResponse == NULL
+            || addIntermediate(p_response, line) < 0)
+        goto error;
+
+    return p_response;
+
+error:
+    at_response_free(p_response);
+    return NULL;
 }
 
 /**
- * The line reader places the intermediate responses in reverse order,
- * here we flip them back.
+ * Puts a copy of cmd into the in-flight window, and writes it if the modem
+ * has nothing else to answer. Waits for room unless called from the reader
+ * thread, i.e. from a completion callback. Assumes commandmutex is held.
  */
-static void reverseIntermediates(ATResponse *p_response)
+static int queueCommand(struct atcontext *ac, const struct atcommand *proto,
+                        long long timeoutMsec, struct atcompletion *out,
+                        int *nout)
 {
-    ATLine *pcur,*pnext;
+    struct atcommand *cmd;
+    int err;
+
+    *nout = 0;
 
-    pcur = p_response->p_intermediates;
-    p_response->p_intermediates = NULL;
+    while (ac->count == MAX_AT_INFLIGHT && ac->readerClosed == 0) {
+        if (0 != pthread_equal(ac->tid_reader, pthread_self()))
+            return AT_ERROR_COMMAND_PENDING;
+
+        if (timeoutMsec != 0)
+            err = pthread_cond_timeout_np(&ac->commandcond, &ac->commandmutex, timeoutMsec);
+        else
+            err = pthread_cond_wait(&ac->commandcond, &ac->commandmutex);
 
-    while (pcur != NULL) {
-        pnext = pcur->p_next;
-        pcur->p_next = p_response->p_intermediates;
-        p_response->p_intermediates = pcur;
-        pcur = pnext;
+        if (err == ETIMEDOUT)
+            return AT_ERROR_TIMEOUT;
     }
+
+    if (ac->fd < 0 || ac->readerClosed > 0)
+        return AT_ERROR_CHANNEL_CLOSED;
+
+    cmd = &ac->commands[(ac->head + ac->count) % MAX_AT_INFLIGHT];
+    memcpy(cmd, proto, sizeof(*cmd));
+    cmd->response = at_response_new();
+    if (cmd->response == NULL)
+        return AT_ERROR_MEMORY_ALLOCATION;
+
+    cmd->timeoutMsec = timeoutMsec;
+    cmd->deadline = 0;
+    ac->count++;
+
+    *nout = startCommand(ac, out);
+
+    return AT_NOERROR;
 }
 
 /**
- * Internal send_command implementation.
- * Doesn't lock or call the timeout callback.
+ * Fills in cmd for queueCommand().
+ */
+static int initCommand(struct atcommand *cmd, const char *command,
+                       ATCommandType type, const char *responsePrefix)
+{
+    memset(cmd, 0, sizeof(*cmd));
+
+    if (strlen(command) >= BUFFSIZE)
+        return AT_ERROR_STRING_CREATION;
+
+    strcpy(cmd->command, command);
+    cmd->type = type;
+    cmd->responsePrefix = responsePrefix;
+
+    return AT_NOERROR;
+}
+
+/**
+ * Queues cmd and waits for it. Doesn't lock or call the timeout callback.
  *
  * timeoutMsec == 0 means infinite timeout.
  */
-static int at_send_command_full_nolock (const char *command, ATCommandType type,
-                    const char *responsePrefix, const char *smspdu,
-                    long long timeoutMsec, ATResponse **pp_outResponse)
+static int sendCommandNolock(struct atcontext *ac, struct atcommand *cmd,
+                             long long timeoutMsec,
+                             ATResponse **pp_outResponse)
 {
     int err = AT_NOERROR;
-
-    struct atcontext *ac = getAtContext();
+    struct atwait wait;
+    struct atcompletion done[MAX_AT_INFLIGHT];
+    long long left;
+    int i, n = 0;
 
     /* Default to NULL, to allow caller to free securely even if
      * no response will be set below */
     if (pp_outResponse != NULL)
         *pp_outResponse = NULL;
 
-    /* FIXME This is to prevent future problems due to calls from other threads; should be revised. */
-    while (pthread_mutex_trylock(&ac->requestmutex) == EBUSY)
-        pthread_cond_wait(&ac->requestcond, &ac->commandmutex);
+    memset(&wait, 0, sizeof(wait));
+    cmd->wait = &wait;
 
-    if(ac->response != NULL) {
-        err = AT_ERROR_COMMAND_PENDING;
-        goto finally;
-    }
+    err = queueCommand(ac, cmd, timeoutMsec, done, &n);
 
-    ac->type = type;
-    ac->responsePrefix = responsePrefix;
-    ac->smsPDU = smspdu;
-    ac->response = at_response_new();
-    if (ac->response == NULL) {
-        err = AT_ERROR_MEMORY_ALLOCATION;
-        goto finally;
+    /* Commands of the window that could not be written. */
+    if (n > 0) {
+        pthread_mutex_unlock(&ac->commandmutex);
+        for (i = 0; i < n; i++)
+            runCompletion(&done[i]);
+        pthread_mutex_lock(&ac->commandmutex);
     }
 
-    err = writeline (command);
-
     if (err != AT_NOERROR)
-        goto finally;
+        return err;
 
-    while (ac->response->finalResponse == NULL && ac->readerClosed == 0) {
-        if (timeoutMsec != 0)
-            err = pthread_cond_timeout_np(&ac->commandcond, &ac->commandmutex, timeoutMsec);
-        else
+    /*
+     * Every completion wakes us, the timeout runs from the write on. Until
+     * then the commands before it are timed on their own.
+     */
+    while (!wait.done) {
+        left = wait.deadline - monotonicMsec();
+        if (wait.deadline == 0)
             err = pthread_cond_wait(&ac->commandcond, &ac->commandmutex);
-
-        if (err == ETIMEDOUT) {
-            err = AT_ERROR_TIMEOUT;
-            goto finally;
+        else if (left > 0)
+            err = pthread_cond_timeout_np(&ac->commandcond, &ac->commandmutex, left);
+        else
+            err = ETIMEDOUT;
+
+        if (err == ETIMEDOUT && !wait.done) {
+            /* The modem is out of step with the window, fail it all. */
+            n = abortCommands(ac, AT_ERROR_TIMEOUT, done);
+            pthread_mutex_unlock(&ac->commandmutex);
+            for (i = 0; i < n; i++)
+                runCompletion(&done[i]);
+            pthread_mutex_lock(&ac->commandmutex);
         }
     }
 
-    if (ac->response->success == 0) {
-        err = at_get_error(ac->response);
-    }
+    err = wait.err;
 
-    if (pp_outResponse == NULL)
-        at_response_free(ac->response);
-    else {
-        /* Line reader stores intermediate responses in reverse order. */
-        reverseIntermediates(ac->response);
-        *pp_outResponse = ac->response;
-    }
-
-    ac->response = NULL;
+    /* Only a response the modem finished is handed out. */
+    if (pp_outResponse == NULL || wait.response == NULL ||
+            wait.response->finalResponse == NULL)
+        at_response_free(wait.response);
+    else
+        *pp_outResponse = wait.response;
 
-    if(ac->readerClosed > 0) {
+    if (err == AT_NOERROR && ac->readerClosed > 0)
         err = AT_ERROR_CHANNEL_CLOSED;
-        goto finally;
-    }
 
-finally:
-    clearPendingCommand();
+    return err;
+}
 
-    pthread_cond_broadcast(&ac->requestcond);
-    pthread_mutex_unlock(&ac->requestmutex);
+/**
+ * Internal send_command implementation.
+ * Doesn't lock or call the timeout callback.
+ *
+ * timeoutMsec == 0 means infinite timeout.
+ */
+static int at_send_command_full_nolock (const char *command, ATCommandType type,
+                    const char *responsePrefix, const char *smspdu,
+                    long long timeoutMsec, ATResponse **pp_outResponse)
+{
+    int err;
+    struct atcommand cmd;
 
-    return err;
+    struct atcontext *ac = getAtContext();
+
+    if (pp_outResponse != NULL)
+        *pp_outResponse = NULL;
+
+    err = initCommand(&cmd, command, type, responsePrefix);
+    if (err != AT_NOERROR)
+        return err;
+    cmd.smsPDU = smspdu;
+
+    return sendCommandNolock(ac, &cmd, timeoutMsec, pp_outResponse);
 }
 
 /**
@@ -1054,6 +1568,44 @@ static int at_send_command_full (const char *command, ATCommandType type,
     return err;
 }
 
+/**
+ * Queues a command without waiting for it, see ATCompletion.
+ * Returns AT_NOERROR once the command is in the window, else the error
+ * as the synchronous calls do, and done is not called.
+ *
+ * "command" should not include \r.
+ */
+int at_send_command_async (const char *command, ATCommandType type,
+                           const char *responsePrefix,
+                           ATCompletion done, void *param)
+{
+    int err;
+
+    struct atcontext *ac = getAtContext();
+    struct atcommand cmd;
+    struct atcompletion failed[MAX_AT_INFLIGHT];
+    int i, n = 0;
+
+    err = initCommand(&cmd, command, type, responsePrefix);
+    if (err == AT_NOERROR) {
+        cmd.done = done;
+        cmd.param = param;
+
+        pthread_mutex_lock(&ac->commandmutex);
+        err = queueCommand(ac, &cmd, ac->timeoutMsec, failed, &n);
+        pthread_mutex_unlock(&ac->commandmutex);
+    }
+
+    /* This one included, if it could not be written. */
+    for (i = 0; i < n; i++)
+        runCompletion(&failed[i]);
+
+    if (err != AT_NOERROR)
+        LOGI(" --- %s", at_str_err(-err));
+
+    return -err;
+}
+
 /* Only call this from onTimeout, since we're not locking or anything. */
 void at_send_escape (void)
 {
@@ -1236,6 +1788,101 @@ int at_send_command_multiline (const char *command,
     return -err;
 }
 
+/**
+ * Issue several commands in one line, see ATBatchCommand.
+ */
+int at_send_command_batch (ATBatchCommand *commands, int count)
+{
+    int err;
+    int i, done = 0;
+    size_t len, n;
+
+    struct atcontext *ac = getAtContext();
+    struct atcommand cmd;
+    ATResponse *response = NULL;
+
+    for (i = 0; i < count; i++)
+        commands[i].p_response = NULL;
+
+    if (0 != pthread_equal(ac->tid_reader, pthread_self()))
+        /* Cannot be called from reader thread. */
+        return -AT_ERROR_INVALID_THREAD;
+
+    err = initCommand(&cmd, "AT", MULTILINE, NULL);
+    if (err != AT_NOERROR)
+        goto finally;
+
+    for (i = 0, len = 2; i < count; i++) {
+        n = strlen(commands[i].command);
+        if (len + n + 1 >= BUFFSIZE) {
+            err = AT_ERROR_STRING_CREATION;
+            goto finally;
+        }
+        if (i > 0)
+            cmd.command[len++] = ';';
+        memcpy(cmd.command + len, commands[i].command, n + 1);
+        len += n;
+
+        commands[i].p_response = at_response_new();
+        if (commands[i].p_response == NULL) {
+            err = AT_ERROR_MEMORY_ALLOCATION;
+            goto finally;
+        }
+    }
+
+    cmd.batch = commands;
+    cmd.batchCount = count;
+
+    pthread_mutex_lock(&ac->commandmutex);
+    err = sendCommandNolock(ac, &cmd, ac->timeoutMsec, &response);
+    pthread_mutex_unlock(&ac->commandmutex);
+
+    if (err == AT_ERROR_TIMEOUT && ac->onTimeout != NULL)
+        ac->onTimeout();
+
+    if (err == AT_NOERROR && response == NULL)
+        err = AT_ERROR_INVALID_RESPONSE;
+
+    /*
+     * On an error the modem skipped the line from the failing command on
+     * (V.250). The commands up to the last one that answered are done.
+     */
+    if (err != AT_NOERROR && response != NULL && !response->success) {
+        for (i = 0; i < count; i++)
+            if (commands[i].p_response->p_intermediates != NULL)
+                done = i + 1;
+    }
+
+finally:
+    for (i = 0; i < count; i++) {
+        ATResponse *p = commands[i].p_response;
+
+        if (p == NULL)
+            continue;
+
+        if ((err != AT_NOERROR && i >= done) || (commands[i].type != NO_RESULT
+                                  && p->p_intermediates == NULL)) {
+            /* Like the single commands, a command with a response must
+               have an intermediate response. */
+            at_response_free(p);
+            commands[i].p_response = NULL;
+        } else if (err != AT_NOERROR) {
+            p->success = 1;
+            p->finalResponse = arenaStrdup(p, "OK");
+        } else {
+            p->success = response->success;
+            p->finalResponse = arenaStrdup(p, response->finalResponse);
+        }
+    }
+
+    at_response_free(response);
+
+    if (err != AT_NOERROR)
+        LOGI(" --- %s", at_str_err(-err));
+
+    return -err;
+}
+
 /**
  * Set the default timeout. Let it be reasonably high, some commands
  * take their time. Default is 10 minutes.
@@ -1247,7 +1894,10 @@ void at_set_timeout_msec(int timeout)
     ac->timeoutMsec = timeout;
 }
 
-/** This callback is invoked on the command thread. */
+/**
+ * This callback is invoked on the command thread, or on the reader thread
+ * when an asynchronous command timed out. No lock is held then.
+ */
 void at_set_on_timeout(void (*onTimeout)(void))
 {
     struct atcontext *ac = getAtContext();
@@ -83,6 +83,26 @@ typedef struct {
  */
 typedef void (*ATUnsolHandler)(const char *s, const char *sms_pdu);
 
+/**
+ * Completion of a command sent with at_send_command_async().
+ * This will be called from the reader thread, so do not block or send
+ * synchronous commands; queueing further asynchronous ones is fine.
+ * If the channel closes or times out it is called from the thread that
+ * finds out. "err" is 0 or the negative error the synchronous calls
+ * return. "p_response" is NULL on error, else it is the callback's to
+ * free with at_response_free(). A NUMERIC, SINGLELINE or MULTILINE
+ * command without an intermediate response is an error.
+ */
+typedef void (*ATCompletion)(int err, ATResponse *p_response, void *param);
+
+/** A command of at_send_command_batch(). */
+typedef struct {
+    const char *command;        /* Without "AT", eg "+CREG?" */
+    ATCommandType type;
+    const char *responsePrefix;
+    ATResponse *p_response;     /* Set by at_send_command_batch(). */
+} ATBatchCommand;
+
 int at_open(int fd, ATUnsolHandler h);
 void at_close(void);
 
@@ -93,7 +113,8 @@ void at_close(void);
 void at_set_timeout_msec(int timeout);
 
 /* 
- * This callback is invoked on the command thread.
+ * This callback is invoked on the command thread, or on the reader thread
+ * if an asynchronous command timed out.
  * You should reset or handshake here to avoid getting out of sync.
  */
 void at_set_on_timeout(void (*onTimeout)(void));
@@ -126,6 +147,27 @@ int at_handshake(void);
 
 int at_send_command (const char *command, ...);
 
+/*
+ * Up to four commands may be in flight on a channel, written one after
+ * the other as the modem completes them. A synchronous command sent after
+ * asynchronous ones waits for them too.
+ */
+int at_send_command_async (const char *command, ATCommandType type,
+                           const char *responsePrefix,
+                           ATCompletion done, void *param);
+
+/*
+ * Sends the commands as one line, eg "AT+CREG?;+CGREG?;+CSQ", and sorts
+ * the intermediate responses to the commands by their prefixes. The modem
+ * answers the line with one final response, each command gets a response
+ * with it, except when a NUMERIC, SINGLELINE or MULTILINE command got no
+ * intermediate response. A failing command ends the line, the error is
+ * returned and the commands the modem was done with keep a successful
+ * response, the failing one and those after it get none. The caller frees
+ * them.
+ */
+int at_send_command_batch (ATBatchCommand *commands, int count);
+
 /* at_send_command_raw do allow missing intermediate response(s) without an
  * error code in the return value. Besides that, the response is not freed.
  * This requires the caller to handle freeing of the response, even in the
@@ -139,6 +181,9 @@ int at_send_command_sms (const char *command, const char *pdu,
 
 void at_response_free(ATResponse *p_response);
 
+ATResponse *at_response_copy(const ATResponse *p_response);
+ATResponse *at_response_from_line(const char *line);
+
 void at_make_default_channel(void);
 
 AT_Error get_at_error(int error);
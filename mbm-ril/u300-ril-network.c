@@ -22,6 +22,9 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 #include <telephony/ril.h>
 #include <assert.h>
 #include "atchannel.h"
@@ -107,6 +110,221 @@ enum ERINFO_umts {
 #define E2REG_ACCESS_CLASS_BARRED 2
 #define E2REG_REGISTERED          5
 
+/*
+ * Network state cache. Android asks for operator, registration and signal
+ * strength in separate requests, and again after every change it is told
+ * of. The answers are kept here. With the screen on the URCs keep them up
+ * to date and they are good for STATE_URC_MAX_AGE_MSEC. With the screen
+ * off the modem reports nothing, so they only answer the rest of a
+ * POLL_STATE burst. Whatever a registration or operator request finds
+ * stale is polled in one command line. With the screen off, +CREG and
+ * +CGREG report the location for that line only.
+ */
+#define STATE_POLL_MAX_AGE_MSEC 2000
+#define STATE_URC_MAX_AGE_MSEC (60 * 1000)
+
+enum stateItem {
+    STATE_CREG,         /* Registration, LAC and CI. */
+    STATE_CGREG,        /* GPRS registration, LAC, CI and AcT. */
+    STATE_ERINFO,       /* Radio access tech. */
+    STATE_SIGNAL,       /* +CSQ, until +CIEV: 2 reports a change. */
+    STATE_COPS,         /* Operator names. */
+    STATE_CGEQNEG,      /* PDP bit rates, only asked when connected. */
+    STATE_COUNT
+};
+
+/* The items before STATE_POLLED are polled, in this order. */
+#define STATE_POLLED STATE_CGEQNEG
+static const ATBatchCommand s_statePoll[STATE_POLLED] = {
+    { "+CREG?", SINGLELINE, "+CREG:", NULL },
+    { "+CGREG?", SINGLELINE, "+CGREG:", NULL },
+    { "*ERINFO?", SINGLELINE, "*ERINFO:", NULL },
+    { "+CSQ", SINGLELINE, "+CSQ:", NULL },
+    { "+COPS=3,0;+COPS?;+COPS=3,1;+COPS?;+COPS=3,2;+COPS?", MULTILINE,
+      "+COPS:", NULL }
+};
+static const ATBatchCommand s_statePollScreenOff = {
+    "+CREG=2;+CGREG=2", NO_RESULT, NULL, NULL
+};
+static const ATBatchCommand s_statePollScreenOffDone = {
+    "+CREG=0;+CGREG=0", NO_RESULT, NULL, NULL
+};
+
+struct stateEntry {
+    ATResponse *response;   /* NULL if the modem could not tell. */
+    long long expires;      /* Monotonic msec, 0 if unknown. */
+};
+
+static pthread_mutex_t s_stateMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct stateEntry s_state[STATE_COUNT];
+
+static long long monotonicMsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Keeps response, which may be NULL for a failed query: then it is not
+ * asked again before the burst is over. Assumes s_stateMutex is held.
+ */
+static void setState(enum stateItem item, ATResponse *response)
+{
+    struct stateEntry *entry = &s_state[item];
+
+    at_response_free(entry->response);
+    entry->response = response;
+    entry->expires = monotonicMsec() +
+        ((response != NULL && getScreenState()) ?
+         STATE_URC_MAX_AGE_MSEC : STATE_POLL_MAX_AGE_MSEC);
+}
+
+/* Assumes s_stateMutex is held. */
+static void dropState(enum stateItem item)
+{
+    at_response_free(s_state[item].response);
+    s_state[item].response = NULL;
+    s_state[item].expires = 0;
+}
+
+/* Assumes s_stateMutex is held. */
+static int isStateFresh(enum stateItem item)
+{
+    return s_state[item].expires > monotonicMsec();
+}
+
+/** Keeps a copy of what a single query got. */
+static void keepState(enum stateItem item, const ATResponse *response)
+{
+    ATResponse *copy = at_response_copy(response);
+
+    pthread_mutex_lock(&s_stateMutex);
+    if (copy != NULL)
+        setState(item, copy);
+    pthread_mutex_unlock(&s_stateMutex);
+}
+
+/**
+ * Forgets the whole state, e.g. when the screen state changes whether the
+ * modem reports changes.
+ */
+void invalidateStateCache(void)
+{
+    int i;
+
+    pthread_mutex_lock(&s_stateMutex);
+    for (i = 0; i < STATE_COUNT; i++)
+        dropState(i);
+    pthread_mutex_unlock(&s_stateMutex);
+}
+
+/**
+ * Polls the stale items in one line. Assumes the screen state lock is
+ * held, it keeps two polls from racing.
+ */
+static void refreshState(void)
+{
+    ATBatchCommand batch[STATE_POLLED + 2];
+    enum stateItem items[STATE_POLLED];
+    int screenOff = !getScreenState();
+    int err, i, first, n = 0, count = 0, failed = 0;
+
+    if (screenOff)
+        batch[n++] = s_statePollScreenOff;
+
+    first = n;
+    pthread_mutex_lock(&s_stateMutex);
+    for (i = 0; i < STATE_POLLED; i++) {
+        if (!isStateFresh(i)) {
+            items[count++] = i;
+            batch[n++] = s_statePoll[i];
+        }
+    }
+    pthread_mutex_unlock(&s_stateMutex);
+
+    if (count == 0)
+        return;
+
+    if (screenOff)
+        batch[n++] = s_statePollScreenOffDone;
+
+    err = at_send_command_batch(batch, n);
+
+    if (screenOff) {
+        /* The modem skips the rest of a failing line, restore anyway. */
+        if (batch[n - 1].p_response == NULL)
+            at_send_command("AT%s", s_statePollScreenOffDone.command);
+        at_response_free(batch[0].p_response);
+        at_response_free(batch[n - 1].p_response);
+    }
+
+    /*
+     * An item without a response failed, it is not asked again before the
+     * burst is over. On an error the modem skipped the items after the
+     * failing one, they stay stale for the next poll.
+     */
+    pthread_mutex_lock(&s_stateMutex);
+    for (i = 0; i < count; i++) {
+        if (batch[first + i].p_response != NULL || err == AT_NOERROR
+                || !failed++)
+            setState(items[i], batch[first + i].p_response);
+    }
+    pthread_mutex_unlock(&s_stateMutex);
+}
+
+/**
+ * Returns a copy of the kept response for item, or NULL if it is stale or
+ * the modem could not tell. If refresh is set the stale items are polled
+ * first, which assumes the screen state lock is held.
+ */
+static ATResponse *getState(enum stateItem item, int refresh)
+{
+    ATResponse *atresponse = NULL;
+    int fresh;
+
+    pthread_mutex_lock(&s_stateMutex);
+    fresh = isStateFresh(item);
+    pthread_mutex_unlock(&s_stateMutex);
+
+    if (refresh && !fresh && item < STATE_POLLED)
+        refreshState();
+
+    pthread_mutex_lock(&s_stateMutex);
+    if (isStateFresh(item))
+        atresponse = at_response_copy(s_state[item].response);
+    pthread_mutex_unlock(&s_stateMutex);
+
+    return atresponse;
+}
+
+/**
+ * Keeps an unsolicited +CREG: or +CGREG: as the registration state. The
+ * operator and the access tech may have changed with it.
+ */
+void onRegistrationStatusChanged(const char *s)
+{
+    ATResponse *atresponse = at_response_from_line(s);
+
+    pthread_mutex_lock(&s_stateMutex);
+    setState(strStartsWith(s, "+CREG:") ? STATE_CREG : STATE_CGREG,
+             atresponse);
+    dropState(STATE_COPS);
+    dropState(STATE_ERINFO);
+    dropState(STATE_CGEQNEG);
+    pthread_mutex_unlock(&s_stateMutex);
+}
+
+/** *E2NAP: the bit rates and the access tech depend on the connection. */
+void invalidateNetworkType(void)
+{
+    pthread_mutex_lock(&s_stateMutex);
+    dropState(STATE_ERINFO);
+    dropState(STATE_CGEQNEG);
+    pthread_mutex_unlock(&s_stateMutex);
+}
+
 /**
  * Poll +COPS? and return a success, or if the loop counter reaches
  * REPOLL_OPERATOR_SELECTED, return generic failure.
@@ -217,6 +435,11 @@ void onNetworkTimeReceived(const char *s)
     char *line, *tok, *response, *time, *timestamp;
     int tz, dst;
 
+    /* The network may name itself anew. */
+    pthread_mutex_lock(&s_stateMutex);
+    dropState(STATE_COPS);
+    pthread_mutex_unlock(&s_stateMutex);
+
     tok = line = strdup(s);
     if (NULL == tok) {
         LOGE("%s() Failed to allocate memory", __func__);
@@ -226,6 +449,7 @@ void onNetworkTimeReceived(const char *s)
     at_tok_start(&tok);
 
     LOGD("%s() Got nitz: %s", __func__, s);
+
     if (at_tok_nextint(&tok, &tz) != 0)
         LOGE("%s() Failed to parse NITZ tz %s", __func__, s);
     else if (at_tok_nextstr(&tok, &time) != 0)
@@ -260,13 +484,8 @@ void onNetworkTimeReceived(const char *s)
     free(line);
 }
 
-int getSignalStrength(RIL_SignalStrength_v6 *signalStrength){
-    ATResponse *atresponse = NULL;
-    int err;
-    char *line;
-    int ber;
-    int rssi;
-
+static void initSignalStrength(RIL_SignalStrength_v6 *signalStrength)
+{
     memset(signalStrength, 0, sizeof(RIL_SignalStrength_v6));
 
     signalStrength->LTE_SignalStrength.signalStrength = 0x7FFFFFFF;
@@ -274,71 +493,90 @@ int getSignalStrength(RIL_SignalStrength_v6 *signalStrength){
     signalStrength->LTE_SignalStrength.rsrq = 0x7FFFFFFF;
     signalStrength->LTE_SignalStrength.rssnr = 0x7FFFFFFF;
     signalStrength->LTE_SignalStrength.cqi = 0x7FFFFFFF;
+}
 
-    err = at_send_command_singleline("AT+CSQ", "+CSQ:", &atresponse);
-
-    if (err != AT_NOERROR)
-        goto cind;
-    
-    line = atresponse->p_intermediates->line;
+/* Returns the rssi of a +CSQ response, or -1 if it cannot be parsed. */
+static int parseCSQ(ATResponse *atresponse,
+                    RIL_SignalStrength_v6 *signalStrength)
+{
+    char *line = atresponse->p_intermediates->line;
+    int ber;
+    int rssi;
 
-    err = at_tok_start(&line);
-    if (err < 0)
-        goto cind;
+    if (at_tok_start(&line) < 0)
+        return -1;
 
-    err = at_tok_nextint(&line,&rssi);
-    if (err < 0)
-        goto cind;
+    if (at_tok_nextint(&line, &rssi) < 0)
+        return -1;
     signalStrength->GW_SignalStrength.signalStrength = rssi;
 
-    err = at_tok_nextint(&line, &ber);
-    if (err < 0)
-        goto cind;
+    if (at_tok_nextint(&line, &ber) < 0)
+        return -1;
     signalStrength->GW_SignalStrength.bitErrorRate = ber;
 
-    at_response_free(atresponse);
-    atresponse = NULL;
-    /*
-     * If we get 99 as signal strength. Try AT+CIND to give
-     * some indication on what signal strength we got.
-     *
-     * Android calculates rssi and dBm values from this value, so the dBm
-     * value presented in android will be wrong, but this is an error on
-     * android's end.
-     */
-    if (rssi == 99) {
-cind:
-        at_response_free(atresponse);
-        atresponse = NULL;
+    return rssi;
+}
 
-        err = at_send_command_singleline("AT+CIND?", "+CIND:", &atresponse);
-        if (err != AT_NOERROR)
-            goto error;
+/*
+ * If we get 99 as signal strength. Try AT+CIND to give
+ * some indication on what signal strength we got.
+ *
+ * Android calculates rssi and dBm values from this value, so the dBm
+ * value presented in android will be wrong, but this is an error on
+ * android's end.
+ */
+static int parseCIND(ATResponse *atresponse,
+                     RIL_SignalStrength_v6 *signalStrength)
+{
+    char *line = atresponse->p_intermediates->line;
 
-        line = atresponse->p_intermediates->line;
+    if (at_tok_start(&line) < 0)
+        return -1;
 
-        err = at_tok_start(&line);
-        if (err < 0)
-            goto error;
+    /* discard the first value */
+    if (at_tok_nextint(&line,
+                       &signalStrength->GW_SignalStrength.signalStrength) < 0)
+        return -1;
 
-        /* discard the first value */
-        err = at_tok_nextint(&line,
-                             &signalStrength->GW_SignalStrength.signalStrength);
-        if (err < 0)
-            goto error;
+    if (at_tok_nextint(&line,
+                       &signalStrength->GW_SignalStrength.signalStrength) < 0)
+        return -1;
 
-        err = at_tok_nextint(&line,
-                             &signalStrength->GW_SignalStrength.signalStrength);
-        if (err < 0)
-            goto error;
+    signalStrength->GW_SignalStrength.bitErrorRate = 99;
 
-        signalStrength->GW_SignalStrength.bitErrorRate = 99;
+    /* Convert CIND value so Android understands it correctly */
+    if (signalStrength->GW_SignalStrength.signalStrength > 0) {
+        signalStrength->GW_SignalStrength.signalStrength *= 4;
+        signalStrength->GW_SignalStrength.signalStrength--;
+    }
 
-        /* Convert CIND value so Android understands it correctly */
-        if (signalStrength->GW_SignalStrength.signalStrength > 0) {
-            signalStrength->GW_SignalStrength.signalStrength *= 4;
-            signalStrength->GW_SignalStrength.signalStrength--;
-        }
+    return 0;
+}
+
+int getSignalStrength(RIL_SignalStrength_v6 *signalStrength){
+    ATResponse *atresponse = NULL;
+    int err;
+    int rssi = -1;
+
+    initSignalStrength(signalStrength);
+
+    atresponse = getState(STATE_SIGNAL, 0);
+    if (atresponse == NULL) {
+        err = at_send_command_singleline("AT+CSQ", "+CSQ:", &atresponse);
+        if (err == AT_NOERROR)
+            keepState(STATE_SIGNAL, atresponse);
+    }
+
+    if (atresponse != NULL)
+        rssi = parseCSQ(atresponse, signalStrength);
+
+    at_response_free(atresponse);
+    atresponse = NULL;
+
+    if (rssi < 0 || rssi == 99) {
+        err = at_send_command_singleline("AT+CIND?", "+CIND:", &atresponse);
+        if (err != AT_NOERROR || parseCIND(atresponse, signalStrength) < 0)
+            goto error;
     }
 
     at_response_free(atresponse);
@@ -349,6 +587,62 @@ error:
     return -1;
 }
 
+/* Completes RIL_REQUEST_SIGNAL_STRENGTH on the reader thread. */
+static void onSignalStrengthCIND(int err, ATResponse *atresponse, void *param)
+{
+    RIL_Token t = (RIL_Token) param;
+    RIL_SignalStrength_v6 signalStrength;
+
+    initSignalStrength(&signalStrength);
+
+    if (err != AT_NOERROR || parseCIND(atresponse, &signalStrength) < 0) {
+        LOGE("%s() Must never return an error when radio is on", __func__);
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+    } else
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, &signalStrength,
+                              sizeof(RIL_SignalStrength_v6));
+
+    at_response_free(atresponse);
+}
+
+static void onSignalStrengthCSQ(int err, ATResponse *atresponse, void *param)
+{
+    RIL_Token t = (RIL_Token) param;
+    RIL_SignalStrength_v6 signalStrength;
+    int rssi = -1;
+
+    initSignalStrength(&signalStrength);
+
+    if (err == AT_NOERROR)
+        rssi = parseCSQ(atresponse, &signalStrength);
+
+    at_response_free(atresponse);
+
+    if (rssi >= 0 && rssi != 99) {
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, &signalStrength,
+                              sizeof(RIL_SignalStrength_v6));
+        return;
+    }
+
+    /* No blocking here, +CIND is chained like +CSQ was. */
+    err = at_send_command_async("AT+CIND?", SINGLELINE, "+CIND:",
+                                onSignalStrengthCIND, t);
+    if (err != AT_NOERROR) {
+        LOGE("%s() Must never return an error when radio is on", __func__);
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+    }
+}
+
+/* Completes a +CSQ that was not kept. */
+static void onSignalStrengthQueried(int err, ATResponse *atresponse,
+                                    void *param)
+{
+    if (err == AT_NOERROR)
+        keepState(STATE_SIGNAL, atresponse);
+
+    onSignalStrengthCSQ(err, atresponse, param);
+}
+
 /**
  * RIL_UNSOL_SIGNAL_STRENGTH
  *
@@ -371,6 +665,15 @@ void pollSignalStrength(void *arg)
 void onSignalStrengthChanged(const char *s)
 {
     (void) s;
+
+    /*
+     * The indicator only has 0-5, the poll asks +CSQ for the rssi. The
+     * one kept is out of date now.
+     */
+    pthread_mutex_lock(&s_stateMutex);
+    dropState(STATE_SIGNAL);
+    pthread_mutex_unlock(&s_stateMutex);
+
     enqueueRILEvent(RIL_EVENT_QUEUE_PRIO, pollSignalStrength, NULL, NULL);
 }
 
@@ -384,6 +687,8 @@ void onNetworkStatusChanged(const char *s)
 
     cs_status = ps_status = 0;
 
+    invalidateStateCache();
+
     tok = line = strdup(s);
     if (tok == NULL)
         goto error;
@@ -937,17 +1242,31 @@ error:
  *
  * Must succeed if radio is on.
  */
+/**
+ * RIL_REQUEST_SIGNAL_STRENGTH
+ *
+ * Answered from the state cache if it is fresh, else completed from the
+ * reader thread, so the next request of the poll burst is queued behind
+ * +CSQ instead of waiting for it.
+ */
 void requestSignalStrength(void *data, size_t datalen, RIL_Token t)
 {
     (void) data; (void) datalen;
-    RIL_SignalStrength_v6 signalStrength;
+    ATResponse *atresponse;
+    int err;
+
+    atresponse = getState(STATE_SIGNAL, 0);
+    if (atresponse != NULL) {
+        onSignalStrengthCSQ(AT_NOERROR, atresponse, t);
+        return;
+    }
 
-    if (getSignalStrength(&signalStrength) < 0) {
+    err = at_send_command_async("AT+CSQ", SINGLELINE, "+CSQ:",
+                                onSignalStrengthQueried, t);
+    if (err != AT_NOERROR) {
         LOGE("%s() Must never return an error when radio is on", __func__);
         RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-    } else
-        RIL_onRequestComplete(t, RIL_E_SUCCESS, &signalStrength,
-                              sizeof(RIL_SignalStrength_v6));
+    }
 }
 
 /**
@@ -1004,11 +1323,16 @@ char *getNetworkType(int def){
     char *line;
     ATResponse *p_response;
 
-    err = at_send_command_singleline("AT*ERINFO?", "*ERINFO:",
-                                     &p_response);
+    p_response = getState(STATE_ERINFO, 0);
+    if (p_response == NULL) {
+        err = at_send_command_singleline("AT*ERINFO?", "*ERINFO:",
+                                         &p_response);
 
-    if (err != AT_NOERROR)
-        return NULL;
+        if (err != AT_NOERROR)
+            return NULL;
+
+        keepState(STATE_ERINFO, p_response);
+    }
 
     line = p_response->p_intermediates->line;
     err = at_tok_start(&line);
@@ -1031,7 +1355,13 @@ char *getNetworkType(int def){
 
     if (umts_rinfo > ERINFO_UMTS_NO_UMTS_HSDPA && getE2napState() == E2NAP_ST_CONNECTED) {
 
-        err = at_send_command_singleline("AT+CGEQNEG=%d", "+CGEQNEG:", &p_response, RIL_CID_IP);
+        err = AT_NOERROR;
+        p_response = getState(STATE_CGEQNEG, 0);
+        if (p_response == NULL) {
+            err = at_send_command_singleline("AT+CGEQNEG=%d", "+CGEQNEG:", &p_response, RIL_CID_IP);
+            if (err == AT_NOERROR)
+                keepState(STATE_CGEQNEG, p_response);
+        }
 
         if (err != AT_NOERROR)
             LOGE("%s() Allocation for, or sending, CGEQNEG failed."
@@ -1124,19 +1454,27 @@ void requestGprsRegistrationState(int request, void *data,
     int commas = 0;
     int skip, tmp;
     int count = 3;
+    int cgregSet = 0;
 
     getScreenStateLock();
-    if (!getScreenState())
-        (void)at_send_command("AT+CGREG=2"); /* Response not vital */
 
     memset(responseStr, 0, sizeof(responseStr));
     memset(response, 0, sizeof(response));
     response[1] = -1;
     response[2] = -1;
 
-    err = at_send_command_singleline("AT+CGREG?", "+CGREG: ", &atresponse);
-    if (err != AT_NOERROR)
-        goto error;
+    atresponse = getState(STATE_CGREG, 1);
+    if (atresponse == NULL) {
+        /* The poll failed, ask on our own. */
+        if (!getScreenState()) {
+            (void)at_send_command("AT+CGREG=2"); /* Response not vital */
+            cgregSet = 1;
+        }
+
+        err = at_send_command_singleline("AT+CGREG?", "+CGREG: ", &atresponse);
+        if (err != AT_NOERROR)
+            goto error;
+    }
 
     line = atresponse->p_intermediates->line;
     err = at_tok_start(&line);
@@ -1252,7 +1590,7 @@ void requestGprsRegistrationState(int request, void *data,
     RIL_onRequestComplete(t, RIL_E_SUCCESS, responseStr, resp_size * sizeof(char *));
 
 finally:
-    if (!getScreenState())
+    if (cgregSet)
         (void)at_send_command("AT+CGREG=0");
 
     releaseScreenStateLock(); /* Important! */
@@ -1293,13 +1631,11 @@ void requestRegistrationState(int request, void *data,
     int commas = 0;
     int skip, cs_status = 0;
     int i;
+    int cregSet = 0;
 
     /* IMPORTANT: Will take screen state lock here. Make sure to always call
                   releaseScreenStateLock BEFORE returning! */
     getScreenStateLock();
-    if (!getScreenState()) {
-        (void)at_send_command("AT+CREG=2"); /* Ignore the response, not VITAL. */
-    }
 
     /* Setting default values in case values are not returned by AT command */
     for (i = 0; i < resp_size; i++)
@@ -1307,10 +1643,19 @@ void requestRegistrationState(int request, void *data,
 
     memset(response, 0, sizeof(response));
 
-    err = at_send_command_singleline("AT+CREG?", "+CREG:", &cgreg_resp);
+    cgreg_resp = getState(STATE_CREG, 1);
+    if (cgreg_resp == NULL) {
+        /* The poll failed, ask on our own. */
+        if (!getScreenState()) {
+            (void)at_send_command("AT+CREG=2"); /* Ignore the response, not VITAL. */
+            cregSet = 1;
+        }
 
-    if (err != AT_NOERROR)
-        goto error;
+        err = at_send_command_singleline("AT+CREG?", "+CREG:", &cgreg_resp);
+
+        if (err != AT_NOERROR)
+            goto error;
+    }
 
     line = cgreg_resp->p_intermediates->line;
 
@@ -1383,6 +1728,28 @@ void requestRegistrationState(int request, void *data,
             goto error;
         break;
     case 3:                    /* +CREG: <n>, <stat>, <lac>, <cid> */
+                               /* +CREG: <stat>, <lac>, <cid>, <AcT> */
+        err = at_tok_nextint(&line, &skip);
+        if (err < 0)
+            goto error;
+
+        /* We need to check if the second parameter is <lac> */
+        if (*(line) == '"') {
+            response[0] = skip; /* <stat> */
+        } else {
+            err = at_tok_nextint(&line, &response[0]); /* <stat> */
+            if (err < 0)
+                goto error;
+        }
+
+        err = at_tok_nexthexint(&line, &response[1]);
+        if (err < 0)
+            goto error;
+
+        err = at_tok_nexthexint(&line, &response[2]);
+        if (err < 0)
+            goto error;
+        break;
     case 4:                    /* +CREG: <n>, <stat>, <lac>, <cid>, <?> */
         err = at_tok_nextint(&line, &skip);
         if (err < 0)
@@ -1454,7 +1821,7 @@ void requestRegistrationState(int request, void *data,
                           resp_size * sizeof(char *));
 
 finally:
-    if (!getScreenState())
+    if (cregSet)
         (void)at_send_command("AT+CREG=0");
 
     releaseScreenStateLock(); /* Important! */
@@ -1472,28 +1839,18 @@ error:
     goto finally;
 }
 
-/**
- * RIL_REQUEST_OPERATOR
- *
- * Request current operator ONS or EONS.
- */
-void requestOperator(void *data, size_t datalen, RIL_Token t)
+/* Completes RIL_REQUEST_OPERATOR on the reader thread. */
+static void onOperator(int err, ATResponse *atresponse, void *param)
 {
-    (void) data; (void) datalen;
-    int err;
+    RIL_Token t = (RIL_Token) param;
     int i;
     int skip;
     ATLine *cursor;
     static const int num_resp_lines = 3;
     char *response[num_resp_lines];
-    ATResponse *atresponse = NULL;
 
     memset(response, 0, sizeof(response));
 
-    err = at_send_command_multiline
-        ("AT+COPS=3,0;+COPS?;+COPS=3,1;+COPS?;+COPS=3,2;+COPS?", "+COPS:",
-         &atresponse);
-
     if (err != AT_NOERROR)
         goto error;
 
@@ -1568,3 +1925,34 @@ error:
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
     goto finally;
 }
+
+/**
+ * RIL_REQUEST_OPERATOR
+ *
+ * Request current operator ONS or EONS.
+ * Usually the first request of a poll burst, so it sends the state poll.
+ * Without one it is completed from the reader thread, like
+ * RIL_REQUEST_SIGNAL_STRENGTH.
+ */
+void requestOperator(void *data, size_t datalen, RIL_Token t)
+{
+    (void) data; (void) datalen;
+    ATResponse *atresponse;
+    int err;
+
+    getScreenStateLock();
+    atresponse = getState(STATE_COPS, 1);
+    releaseScreenStateLock();
+
+    if (atresponse != NULL) {
+        onOperator(AT_NOERROR, atresponse, t);
+        return;
+    }
+
+    err = at_send_command_async
+        ("AT+COPS=3,0;+COPS?;+COPS=3,1;+COPS?;+COPS=3,2;+COPS?", MULTILINE,
+         "+COPS:", onOperator, t);
+
+    if (err != AT_NOERROR)
+        RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+}
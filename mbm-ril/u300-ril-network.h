@@ -28,6 +28,9 @@
 void onNetworkTimeReceived(const char *s);
 void onSignalStrengthChanged(const char *s);
 void onNetworkStatusChanged(const char *s);
+void onRegistrationStatusChanged(const char *s);
+void invalidateNetworkType(void);
+void invalidateStateCache(void);
 
 int getPreferredNetworkType(void);
 
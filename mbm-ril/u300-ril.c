@@ -288,6 +288,9 @@ static void requestScreenState(void *data, size_t datalen, RIL_Token t)
 
     screenState = s_screenState = ((int *) data)[0];
 
+    /* Whether the modem reports changes differs, start over. */
+    invalidateStateCache();
+
     if (screenState == 1) {
         /* Screen is on - be sure to enable all unsolicited notifications again. */
         err = at_send_command("AT+CREG=2");
@@ -863,8 +866,10 @@ static void onUnsolicited(const char *s, const char *sms_pdu)
         enqueueRILEvent(RIL_EVENT_QUEUE_PRIO, pollSIMState, NULL, NULL);
     } else if (strStartsWith(s, "*ESIMSR"))
         onSimStateChanged(s);
-    else if(strStartsWith(s, "*E2NAP:"))
+    else if(strStartsWith(s, "*E2NAP:")) {
         onConnectionStateChanged(s);
+        invalidateNetworkType();
+    }
     else if(strStartsWith(s, "*E2REG:"))
         onNetworkStatusChanged(s);
     else if (strStartsWith(s, "*EESIMSWAP:"))
@@ -872,6 +877,7 @@ static void onUnsolicited(const char *s, const char *sms_pdu)
     else if (strStartsWith(s, "+CREG:")
             || strStartsWith(s, "+CGREG:")) {
 /*TODO: If only reporting back network change Android can sometimes hang!! */
+        onRegistrationStatusChanged(s);
         RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
                                   NULL, 0);
     }
@@ -928,7 +934,11 @@ static void onATReaderClosed(void)
     at_close();
 }
 
-/* Called on command thread. */
+/*
+ * Called on command thread, or on the reader thread when an asynchronous
+ * command timed out. It sends no AT command and waits for nothing, so
+ * either is fine.
+ */
 static void onATTimeout(void)
 {
     LOGI("AT channel timeout; restarting..");